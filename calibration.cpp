@@ -0,0 +1,306 @@
+#include "calibration.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+
+AutoCalibration::AutoCalibration(FatigueDetector& d, CalibrationSettings s)
+    : detector(d), settings(s) {}
+
+void AutoCalibration::apply(const CalibrationResult& result, Libcam2OpenCVSettings& camera) {
+    camera.width = result.width;
+    camera.height = result.height;
+    camera.framerate = result.framerate;
+}
+
+CalibrationResult AutoCalibration::calibrate() {
+    CalibrationResult best;
+    if (loadCache(best)) {
+        detector.setSettings(best.detector);
+        std::cerr << "Calibration (cached): " << best.width << "x" << best.height << "@" << best.framerate
+                  << ", detect scale " << best.detector.detectScale
+                  << ", refresh every " << best.detector.refreshInterval << " frames" << std::endl;
+        return best;
+    }
+
+    const FatigueDetectorSettings original = detector.getSettings();
+    const std::vector<cv::Mat> samples = sampleFrames();
+
+    // 候选按质量从高到低：分辨率 > 检测缩放 > 完整检测频率
+    std::vector<cv::Size> resolutions = {
+        {1280, 960}, {1024, 768}, {800, 600}, {640, 480}, {400, 300} };
+    if (!settings.resolution.empty()) resolutions = { settings.resolution };
+    const std::vector<float> scales = { 1.0f, 0.5f };
+
+    bool found = false;
+    CalibrationResult cheapest;
+    cheapest.latencyMs = -1.0;
+    for (const auto& res : resolutions) {
+        for (float scale : scales) {
+            Candidate c = { (unsigned int)res.width, (unsigned int)res.height, scale, 6 };
+            CalibrationResult r;
+            r.detector = original;
+            const bool ok = benchmark(c, samples, r);
+            std::cerr << "Calibration: " << c.width << "x" << c.height << " scale " << scale;
+            if (ok)
+                std::cerr << ": " << r.latencyMs << " ms, refresh " << r.detector.refreshInterval
+                          << (r.trackingTimed ? "" : " (kept, no face in the samples)")
+                          << ", " << r.framerate << " fps" << std::endl;
+            else
+                std::cerr << ": over budget (" << r.latencyMs << " ms)" << std::endl;
+            if (ok) {
+                best = r;
+                found = true;
+                break;
+            }
+            if (cheapest.latencyMs < 0 || r.latencyMs < cheapest.latencyMs) cheapest = r;
+        }
+        if (found) break;
+    }
+
+    if (!found) {
+        std::cerr << "Calibration: no configuration meets the " << settings.latencyBudgetMs
+                  << " ms budget, using the fastest one: " << cheapest.width << "x" << cheapest.height
+                  << "@" << cheapest.framerate << ", " << cheapest.latencyMs << " ms" << std::endl;
+        best = cheapest;
+    }
+
+    detector.setSettings(best.detector);
+    // 基准测试留下的统计和融合状态不能带进实际检测
+    detector.reset();
+    // 超出预算或关键点阶段没有计时（样本中没有人脸）的结果不缓存，
+    // 下次启动（例如放入样本帧之后）重新标定
+    if (found && best.trackingTimed)
+        saveCache(best);
+    else if (found)
+        std::cerr << "Calibration: no face in the samples, the result is not cached" << std::endl;
+    return best;
+}
+
+// 对一个分辨率 / 检测缩放组合计时，完整检测和光流帧分别统计，
+// 再按不同的完整检测间隔估算帧率和延迟。超出预算时 r 保留原来的跟踪设置，
+// 帧率和延迟按实测估算
+bool AutoCalibration::benchmark(const Candidate& c, const std::vector<cv::Mat>& samples, CalibrationResult& r) {
+    typedef std::chrono::duration<double, std::milli> ms;
+    const FatigueDetectorSettings original = r.detector;
+    // 按平均每帧耗时填写帧率和延迟
+    auto estimate = [&](double mean, double worst) {
+        const unsigned int fps = std::max(1u, std::min(settings.maxFramerate, (unsigned int)(1000.0 / mean)));
+        r.framerate = fps;
+        r.meanFrameMs = mean;
+        r.worstFrameMs = worst;
+        r.latencyMs = worst + 1000.0 / fps;
+        return r.latencyMs <= settings.latencyBudgetMs;
+    };
+    auto keepTracking = [&]() {
+        r.detector.trackLandmarks = original.trackLandmarks;
+        r.detector.refreshInterval = original.refreshInterval;
+    };
+    FatigueDetectorSettings ds = r.detector;
+    ds.detectScale = c.detectScale;
+    ds.trackLandmarks = true;
+    ds.refreshInterval = c.refreshInterval;
+    detector.setSettings(ds);
+
+    std::vector<cv::Mat> frames;
+    for (const auto& s : samples) {
+        cv::Mat f;
+        cv::resize(s, f, cv::Size(c.width, c.height), 0, 0, cv::INTER_AREA);
+        frames.push_back(f);
+    }
+
+    r.width = c.width;
+    r.height = c.height;
+    r.detector = ds;
+
+    double fullSum = 0.0, trackedSum = 0.0, worst = 0.0;
+    unsigned int fullN = 0, trackedN = 0;
+    const unsigned int n = std::max(settings.framesPerCandidate, 2 * c.refreshInterval);
+    for (unsigned int i = 0; i < n; ++i) {
+        // 每张样本连续送 refreshInterval 帧，让光流有机会跟踪
+        const cv::Mat& frame = frames[(i / c.refreshInterval) % frames.size()];
+        const unsigned long trackedBefore = detector.getTrackingStats().trackedFrames;
+
+        // 与 Window::updateImage 相同的路径：拷贝、检测、颜色转换
+        auto t0 = std::chrono::high_resolution_clock::now();
+        cv::Mat input = frame.clone(), output, rgb;
+        detector.detect(input, output);
+        cv::cvtColor(output, rgb, cv::COLOR_BGR2RGB);
+        const double t = ms(std::chrono::high_resolution_clock::now() - t0).count();
+
+        if (detector.getTrackingStats().trackedFrames > trackedBefore) {
+            trackedSum += t;
+            trackedN++;
+        } else {
+            fullSum += t;
+            fullN++;
+            worst = std::max(worst, t);
+        }
+        // 最慢一帧已超出预算时不必继续
+        if (worst > settings.latencyBudgetMs) {
+            keepTracking();
+            estimate(worst, worst);
+            return false;
+        }
+    }
+
+    const double full = fullN ? fullSum / fullN : worst;
+
+    // 样本中没有人脸时 shape_predictor 和光流都没有计时，无从选择完整检测间隔：
+    // 保留原来的跟踪设置，按每帧完整检测估算
+    r.trackingTimed = trackedN > 0;
+    if (!r.trackingTimed) {
+        keepTracking();
+        return estimate(full, worst);
+    }
+    const double tracked = trackedSum / trackedN;
+
+    // 完整检测间隔从小到大：越小质量越高
+    const unsigned int intervals[] = { 1, 3, 6 };
+    for (unsigned int interval : intervals) {
+        r.detector.trackLandmarks = interval > 1;
+        r.detector.refreshInterval = interval;
+        if (estimate((full + (interval - 1) * tracked) / interval, worst)) return true;
+    }
+
+    // 都超出预算：按原来的跟踪设置估算
+    keepTracking();
+    const unsigned int interval = original.trackLandmarks ? std::max(1u, original.refreshInterval) : 1;
+    estimate((full + (interval - 1) * tracked) / interval, worst);
+    return false;
+}
+
+std::vector<cv::Mat> AutoCalibration::sampleFrames() {
+    std::vector<cv::Mat> samples;
+    std::vector<cv::String> files;
+    if (!settings.sampleDir.empty()) {
+        struct stat st;
+        if (stat(settings.sampleDir.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            for (const char* pattern : { "/*.jpg", "/*.png" }) {
+                std::vector<cv::String> found;
+                cv::glob(settings.sampleDir + pattern, found, false);
+                files.insert(files.end(), found.begin(), found.end());
+            }
+        }
+    }
+    for (const auto& f : files) {
+        cv::Mat img = cv::imread(f, cv::IMREAD_COLOR);
+        if (!img.empty()) samples.push_back(img);
+    }
+
+    // 没有样本时用合成帧：HOG 检测耗时只取决于分辨率，与内容无关，
+    // 但合成帧中找不到人脸，关键点和光流不会被计时
+    if (samples.empty()) {
+        std::cerr << "Calibration: no sample frames in '" << settings.sampleDir
+                  << "', using synthetic frames (the landmark tracking settings are kept)" << std::endl;
+        cv::RNG rng(1234);
+        for (int i = 0; i < 3; ++i) {
+            cv::Mat img(960, 1280, CV_8UC3);
+            rng.fill(img, cv::RNG::UNIFORM, 0, 255);
+            cv::GaussianBlur(img, img, cv::Size(9, 9), 0);
+            cv::ellipse(img, cv::Point(640, 480), cv::Size(180, 240), 0, 0, 360, cv::Scalar(150, 170, 200), -1);
+            samples.push_back(img);
+        }
+    }
+    return samples;
+}
+
+std::string AutoCalibration::machineKey() {
+    std::string model;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        // x86: "model name"，树莓派: "Model"
+        if (line.rfind("model name", 0) == 0 || line.rfind("Model", 0) == 0) {
+            model = line.substr(line.find(':') + 1);
+            model.erase(0, model.find_first_not_of(' '));
+        }
+    }
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    return std::string(host) + "|" + model + "|" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::string AutoCalibration::resolutionKey() const {
+    if (settings.resolution.empty()) return "any";
+    return std::to_string(settings.resolution.width) + "x" + std::to_string(settings.resolution.height);
+}
+
+std::string AutoCalibration::cachePath() const {
+    if (!settings.cacheFile.empty()) return settings.cacheFile;
+    std::string dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        dir = xdg;
+    } else if (const char* home = std::getenv("HOME")) {
+        dir = std::string(home) + "/.cache";
+    } else {
+        dir = ".";
+    }
+    mkdir(dir.c_str(), 0755);
+    return dir + "/fatigue_calibration.txt";
+}
+
+bool AutoCalibration::loadCache(CalibrationResult& r) {
+    std::ifstream in(cachePath());
+    if (!in) return false;
+    std::map<std::string, std::string> kv;
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t eq = line.find('=');
+        if (eq != std::string::npos) kv[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+
+    // 换了机器、预算或固定分辨率时重新标定
+    if (kv["machine"] != machineKey()) return false;
+    if (kv["resolution"] != resolutionKey()) return false;
+    try {
+        if (std::fabs(std::stod(kv["budget"]) - settings.latencyBudgetMs) > 0.01) return false;
+        if ((unsigned int)std::stoul(kv["maxFramerate"]) != settings.maxFramerate) return false;
+        r.width = std::stoul(kv["width"]);
+        r.height = std::stoul(kv["height"]);
+        r.framerate = std::stoul(kv["framerate"]);
+        r.detector = detector.getSettings();
+        r.detector.detectScale = std::stof(kv["detectScale"]);
+        // 标定时没能给光流计时则沿用当前的跟踪设置
+        r.trackingTimed = kv["trackingTimed"] == "1";
+        if (r.trackingTimed) {
+            r.detector.trackLandmarks = kv["trackLandmarks"] == "1";
+            r.detector.refreshInterval = std::stoul(kv["refreshInterval"]);
+        }
+        r.worstFrameMs = std::stod(kv["worstFrameMs"]);
+        r.meanFrameMs = std::stod(kv["meanFrameMs"]);
+        r.latencyMs = std::stod(kv["latencyMs"]);
+    } catch (std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void AutoCalibration::saveCache(const CalibrationResult& r) {
+    std::ofstream out(cachePath());
+    if (!out) {
+        std::cerr << "Calibration: can't write " << cachePath() << std::endl;
+        return;
+    }
+    out << "machine=" << machineKey() << "\n"
+        << "budget=" << settings.latencyBudgetMs << "\n"
+        << "maxFramerate=" << settings.maxFramerate << "\n"
+        << "resolution=" << resolutionKey() << "\n"
+        << "width=" << r.width << "\n"
+        << "height=" << r.height << "\n"
+        << "framerate=" << r.framerate << "\n"
+        << "detectScale=" << r.detector.detectScale << "\n"
+        << "trackLandmarks=" << (r.detector.trackLandmarks ? 1 : 0) << "\n"
+        << "refreshInterval=" << r.detector.refreshInterval << "\n"
+        << "trackingTimed=" << (r.trackingTimed ? 1 : 0) << "\n"
+        << "worstFrameMs=" << r.worstFrameMs << "\n"
+        << "meanFrameMs=" << r.meanFrameMs << "\n"
+        << "latencyMs=" << r.latencyMs << "\n";
+}
@@ -0,0 +1,77 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "libcam2opencv.h"
+#include "fatigue_detector.h"
+
+// 启动自动标定设置
+struct CalibrationSettings {
+    // 端到端延迟预算（毫秒）：最慢一帧的处理时间 + 帧间隔
+    double latencyBudgetMs = 150.0;
+
+    // 摄像头最高帧率
+    unsigned int maxFramerate = 30;
+
+    // 每个候选配置计时的帧数
+    unsigned int framesPerCandidate = 10;
+
+    // 固定的输出分辨率（例如人脸裁剪的 400x300），只标定检测设置和帧率；
+    // 为空时从候选分辨率中选择
+    cv::Size resolution;
+
+    // 样本帧目录（jpg/png，需含人脸才能给关键点和光流计时），
+    // 为空或无图片时使用合成帧，结果不缓存
+    std::string sampleDir = "calibration";
+
+    // 缓存文件，为空时使用 $XDG_CACHE_HOME（或 ~/.cache）/fatigue_calibration.txt
+    std::string cacheFile;
+};
+
+// 标定结果
+struct CalibrationResult {
+    unsigned int width = 800;
+    unsigned int height = 600;
+    unsigned int framerate = 30;
+    FatigueDetectorSettings detector;
+    double worstFrameMs = 0.0;   // 最慢一帧（完整检测）
+    double meanFrameMs = 0.0;    // 平均每帧
+    double latencyMs = 0.0;      // 估计的端到端延迟
+    bool trackingTimed = false;  // 样本中有人脸，光流跟踪已计时并选择了完整检测间隔
+};
+
+// 在启动时对不同分辨率和检测设置计时，选出满足延迟预算的最高质量配置，
+// 结果按机器缓存，之后的启动直接读取缓存
+class AutoCalibration {
+public:
+    AutoCalibration(FatigueDetector& detector, CalibrationSettings settings = CalibrationSettings());
+
+    // 读取缓存或运行标定，成功后已应用到检测器
+    CalibrationResult calibrate();
+
+    // 把结果写入摄像头设置（只改分辨率和帧率）
+    static void apply(const CalibrationResult& result, Libcam2OpenCVSettings& camera);
+
+private:
+    struct Candidate {
+        unsigned int width, height;
+        float detectScale;
+        unsigned int refreshInterval;
+    };
+
+    std::vector<cv::Mat> sampleFrames();
+    bool benchmark(const Candidate& c, const std::vector<cv::Mat>& samples, CalibrationResult& r);
+    bool loadCache(CalibrationResult& r);
+    void saveCache(const CalibrationResult& r);
+    std::string cachePath() const;
+    std::string resolutionKey() const;
+    static std::string machineKey();
+
+    FatigueDetector& detector;
+    CalibrationSettings settings;
+};
+
+#endif // CALIBRATION_H
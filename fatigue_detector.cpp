@@ -1,7 +1,10 @@
 #include "fatigue_detector.h"
+#include "frametrace.h"
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 
-FatigueDetector::FatigueDetector() {
+FatigueDetector::FatigueDetector(FatigueDetectorSettings s) : settings(s) {
     try {
         dlib::deserialize("shape_predictor_68_face_landmarks.dat") >> predictor;
         detector = dlib::get_frontal_face_detector();
@@ -22,20 +25,170 @@ FatigueDetector::FatigueDetector() {
     measurement = cv::Mat_<float>(2, 1);
 }
 
-float FatigueDetector::eyeAspectRatio(const std::vector<dlib::point>& eye) {
-    double A = dlib::length(eye[1] - eye[5]);
-    double B = dlib::length(eye[2] - eye[4]);
-    double C = dlib::length(eye[0] - eye[3]);
+void FatigueDetector::setSettings(const FatigueDetectorSettings& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    settings = s;
+    trackValid = false;
+}
+
+void FatigueDetector::resetTracking() {
+    std::lock_guard<std::mutex> lock(mutex);
+    trackValid = false;
+    framesSinceFull = 0;
+}
+
+void FatigueDetector::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    trackValid = false;
+    framesSinceFull = 0;
+    faceBox = cv::Rect2f();
+    stats = LandmarkTrackingStats();
+    kalmanInitialized = false;
+    eyeClosed = false;
+    yawnDetected = false;
+    eyeClosedDuration = 0.0;
+    yawnDuration = 0.0;
+    prevEBBA.clear();
+    prevMBBA.clear();
+}
+
+LandmarkTrackingStats FatigueDetector::getTrackingStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+cv::Rect2f FatigueDetector::lastFace() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return faceBox;
+}
+
+double LandmarkTrackingStats::latencyReductionMs() const {
+    const unsigned long frames = fullFrames + trackedFrames;
+    if (0 == frames || 0 == fullFrames) return 0.0;
+    return meanFullMs() - (fullMsSum + trackedMsSum) / frames;
+}
+
+void LandmarkTrackingStats::print(std::ostream& os) const {
+    os << "Landmarks: " << fullFrames << " full, " << trackedFrames << " tracked, "
+       << forcedRedetects << " forced re-detects" << std::endl;
+    os << "  EAR drift mean/max: " << meanEarDrift() << " / " << earDriftMax
+       << ", MAR drift mean/max: " << meanMarDrift() << " / " << marDriftMax
+       << " (" << driftSamples << " samples)" << std::endl;
+    os << "  latency full/tracked: " << meanFullMs() << " / " << meanTrackedMs()
+       << " ms, reduction per frame: " << latencyReductionMs() << " ms" << std::endl;
+}
+
+float FatigueDetector::eyeAspectRatio(const std::vector<cv::Point2f>& eye) {
+    double A = cv::norm(eye[1] - eye[5]);
+    double B = cv::norm(eye[2] - eye[4]);
+    double C = cv::norm(eye[0] - eye[3]);
     return (A + B) / (2.0 * C);
 }
 
-float FatigueDetector::mouth_aspect_ratio(const std::vector<cv::Point>& mouth) {
+float FatigueDetector::mouth_aspect_ratio(const std::vector<cv::Point2f>& mouth) {
     float A = cv::norm(mouth[2] - mouth[9]);
     float B = cv::norm(mouth[4] - mouth[7]);
     float C = cv::norm(mouth[0] - mouth[6]);
     return (A + B) / (2.0f * C);
 }
 
+void FatigueDetector::landmarkRatios(const std::vector<cv::Point2f>& pts, float& ear, float& mar) {
+    std::vector<cv::Point2f> left_eye(pts.begin(), pts.begin() + 6);
+    std::vector<cv::Point2f> right_eye(pts.begin() + 6, pts.begin() + 12);
+    std::vector<cv::Point2f> mouth(pts.begin() + 12, pts.end());
+    ear = (eyeAspectRatio(left_eye) + eyeAspectRatio(right_eye)) / 2.0f;
+    mar = mouth_aspect_ratio(mouth);
+}
+
+float FatigueDetector::interOcular(const std::vector<cv::Point2f>& pts) {
+    cv::Point2f l(0, 0), r(0, 0);
+    for (int i = 0; i < 6; ++i) {
+        l += pts[i];
+        r += pts[i + 6];
+    }
+    return cv::norm(l - r) / 6.0;
+}
+
+// 完整检测：人脸检测 + shape_predictor，取 36–59 号点
+bool FatigueDetector::fullLandmarks(const cv::Mat& frame, std::vector<cv::Point2f>& pts) {
+    FrameTrace::Span span("landmarks (full)");
+    dlib::cv_image<dlib::bgr_pixel> cimg(frame);
+
+    std::vector<dlib::rectangle> faces;
+    const float scale = settings.detectScale;
+    if (scale > 0.0f && scale < 1.0f) {
+        cv::Mat small;
+        cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+        dlib::cv_image<dlib::bgr_pixel> smallImg(small);
+        for (const auto& r : detector(smallImg))
+            faces.emplace_back(r.left() / scale, r.top() / scale, r.right() / scale, r.bottom() / scale);
+    } else {
+        faces = detector(cimg);
+    }
+    if (faces.empty()) return false;
+
+    dlib::full_object_detection shape = predictor(cimg, faces[0]);
+    faceBox = cv::Rect2f(faces[0].left(), faces[0].top(), faces[0].width(), faces[0].height());
+
+    pts.clear();
+    for (int i = FIRST_TRACKED; i < FIRST_TRACKED + NUM_TRACKED; ++i)
+        pts.emplace_back(shape.part(i).x(), shape.part(i).y());
+    return true;
+}
+
+// 保存关键点周围的小灰度块，供下一帧光流使用
+void FatigueDetector::storePatch(const cv::Mat& frame, const std::vector<cv::Point2f>& pts) {
+    cv::Rect roi = cv::boundingRect(pts);
+    roi.x -= PATCH_MARGIN;
+    roi.y -= PATCH_MARGIN;
+    roi.width += 2 * PATCH_MARGIN;
+    roi.height += 2 * PATCH_MARGIN;
+    roi &= cv::Rect(0, 0, frame.cols, frame.rows);
+    if (roi.empty()) {
+        trackValid = false;
+        return;
+    }
+    cv::cvtColor(frame(roi), prevPatch, cv::COLOR_BGR2GRAY);
+    prevRoi = roi;
+    prevPts = pts;
+    trackValid = true;
+}
+
+// 金字塔 LK 光流跟踪 24 个眼/嘴关键点，前向-后向误差过大或尺度漂移时返回 false
+bool FatigueDetector::trackLandmarks(const cv::Mat& frame, std::vector<cv::Point2f>& pts) {
+    if (!trackValid) return false;
+    FrameTrace::Span span("landmarks (optical flow)");
+    if ((prevRoi & cv::Rect(0, 0, frame.cols, frame.rows)) != prevRoi) return false;
+
+    cv::Mat patch;
+    cv::cvtColor(frame(prevRoi), patch, cv::COLOR_BGR2GRAY);
+
+    const cv::Point2f tl(prevRoi.x, prevRoi.y);
+    std::vector<cv::Point2f> local, next, back;
+    for (const auto& p : prevPts) local.push_back(p - tl);
+
+    const cv::Size win(15, 15);
+    const int maxLevel = 2;
+    std::vector<uchar> status, backStatus;
+    std::vector<float> err;
+    cv::calcOpticalFlowPyrLK(prevPatch, patch, local, next, status, err, win, maxLevel);
+    cv::calcOpticalFlowPyrLK(patch, prevPatch, next, back, backStatus, err, win, maxLevel);
+
+    const cv::Rect2f inside(0, 0, patch.cols, patch.rows);
+    pts.clear();
+    for (size_t i = 0; i < local.size(); ++i) {
+        if (!status[i] || !backStatus[i]) return false;
+        if (cv::norm(back[i] - local[i]) > settings.fbErrorThreshold) return false;
+        if (!inside.contains(next[i])) return false;
+        pts.push_back(next[i] + tl);
+    }
+
+    if (refInterOcular > 0.0f &&
+        std::fabs(interOcular(pts) / refInterOcular - 1.0f) > settings.maxScaleDrift)
+        return false;
+    return true;
+}
+
 std::map<std::string, double> FatigueDetector::calculateEBBA(double ear, double eyeClosedDuration) {
     std::map<std::string, double> ebba = { {"NORMAL", 0.0}, {"MEDIUM", 0.0}, {"FATIGUE", 0.0} };
     if (ear > EAR_WARNING_THRESHOLD) {
@@ -80,18 +233,75 @@ std::map<std::string, double> FatigueDetector::combineBBA(const std::map<std::st
 }
 
 bool FatigueDetector::detect(const cv::Mat& frame, cv::Mat& output) {
+    std::lock_guard<std::mutex> lock(mutex);
     output = frame.clone();
-    dlib::cv_image<dlib::bgr_pixel> cimg(frame);
 
-    auto faces = detector(cimg);
-    if (faces.empty()) return false;
+    typedef std::chrono::duration<double, std::milli> ms;
+    std::vector<cv::Point2f> pts, tracked;
+    bool haveTracked = false;
+    const bool refreshDue = framesSinceFull + 1 >= settings.refreshInterval;
 
-    dlib::full_object_detection shape = predictor(cimg, faces[0]);
+    // 关键点阶段整体计时：刷新帧包含用于漂移采样的光流耗时
+    const auto t0 = std::chrono::high_resolution_clock::now();
+    bool trackedFrame = false;
+
+    // 多速率：两次完整检测之间只做光流传播
+    if (settings.trackLandmarks && trackValid) {
+        haveTracked = trackLandmarks(frame, tracked);
+        if (haveTracked && !refreshDue) {
+            // 人脸框随关键点平均位移平移
+            cv::Point2f shift(0, 0);
+            for (size_t i = 0; i < tracked.size(); ++i) shift += tracked[i] - prevPts[i];
+            shift *= 1.0f / tracked.size();
+            faceBox.x += shift.x;
+            faceBox.y += shift.y;
+            framesSinceFull++;
+            pts = tracked;
+            storePatch(frame, pts);
+            trackedFrame = true;
+        } else if (!haveTracked && !refreshDue) {
+            stats.forcedRedetects++;
+        }
+    }
+
+    if (!trackedFrame) {
+        if (!fullLandmarks(frame, pts)) {
+            trackValid = false;
+            faceBox = cv::Rect2f();
+            return false;
+        }
+        framesSinceFull = 0;
+
+        if (settings.trackLandmarks) {
+            // 用完整检测结果度量光流的 EAR/MAR 漂移
+            if (haveTracked) {
+                float earT, marT, earF, marF;
+                landmarkRatios(tracked, earT, marT);
+                landmarkRatios(pts, earF, marF);
+                const double earDrift = std::fabs(earT - earF);
+                const double marDrift = std::fabs(marT - marF);
+                stats.earDriftSum += earDrift;
+                stats.marDriftSum += marDrift;
+                stats.earDriftMax = std::max(stats.earDriftMax, earDrift);
+                stats.marDriftMax = std::max(stats.marDriftMax, marDrift);
+                stats.driftSamples++;
+            }
+            refInterOcular = interOcular(pts);
+            storePatch(frame, pts);
+        }
+    }
 
-    std::vector<dlib::point> left_eye, right_eye;
-    for (int i = 36; i <= 41; ++i) left_eye.push_back(shape.part(i));
-    for (int i = 42; i <= 47; ++i) right_eye.push_back(shape.part(i));
-    float ear = (eyeAspectRatio(left_eye) + eyeAspectRatio(right_eye)) / 2.0f;
+    const double landmarkMs = ms(std::chrono::high_resolution_clock::now() - t0).count();
+    if (trackedFrame) {
+        stats.trackedMsSum += landmarkMs;
+        stats.trackedFrames++;
+    } else {
+        stats.fullMsSum += landmarkMs;
+        stats.fullFrames++;
+    }
+
+    float ear, mar;
+    landmarkRatios(pts, ear, mar);
 
     auto now = std::chrono::high_resolution_clock::now();
     if (ear < EAR_DANGER_THRESHOLD && !eyeClosed) {
@@ -102,11 +312,6 @@ bool FatigueDetector::detect(const cv::Mat& frame, cv::Mat& output) {
         eyeClosed = false;
     }
 
-    std::vector<cv::Point> mouth;
-    for (int i = 48; i <= 59; ++i)
-        mouth.emplace_back(shape.part(i).x(), shape.part(i).y());
-    float mar = mouth_aspect_ratio(mouth);
-
     if (mar > MAR_YAWN_THRESHOLD && !yawnDetected) {
         lastYawnStart = now;
         yawnDetected = true;
@@ -115,6 +320,7 @@ bool FatigueDetector::detect(const cv::Mat& frame, cv::Mat& output) {
         yawnDetected = false;
     }
 
+    FrameTrace::Span fusion("fusion");
     auto ebba = calculateEBBA(ear, eyeClosedDuration);
     auto mbba = calculateMBBA(mar, yawnDuration);
     if (!prevEBBA.empty()) ebba = combineBBA(prevEBBA, ebba);
@@ -6,28 +6,105 @@
 #include <dlib/image_processing.h>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <map>
+#include <mutex>
+#include <ostream>
 #include <string>
 #include <chrono>
+#include <vector>
+
+// 检测器设置
+struct FatigueDetectorSettings {
+    // 多速率模式：两次完整 shape_predictor 之间用 LK 光流跟踪眼/嘴关键点
+    bool trackLandmarks = false;
+
+    // 每隔多少帧强制运行一次完整的人脸检测 + shape_predictor
+    unsigned int refreshInterval = 5;
+
+    // 前向-后向误差阈值（像素），超出则强制重新检测
+    float fbErrorThreshold = 1.0f;
+
+    // 双眼间距相对上次完整检测的最大变化比例，超出视为漂移
+    float maxScaleDrift = 0.15f;
+
+    // 人脸检测前的缩放比例（<1 加快 HOG 检测），关键点仍在原图上定位
+    float detectScale = 1.0f;
+};
+
+// 多速率跟踪统计
+struct LandmarkTrackingStats {
+    unsigned long fullFrames = 0;      // 完整检测帧数
+    unsigned long trackedFrames = 0;   // 光流跟踪帧数
+    unsigned long forcedRedetects = 0; // 前向-后向/漂移触发的重新检测
+    unsigned long driftSamples = 0;    // 与完整检测对比的样本数
+    double earDriftSum = 0.0, earDriftMax = 0.0;
+    double marDriftSum = 0.0, marDriftMax = 0.0;
+    double fullMsSum = 0.0, trackedMsSum = 0.0;
+
+    double meanEarDrift() const { return driftSamples ? earDriftSum / driftSamples : 0.0; }
+    double meanMarDrift() const { return driftSamples ? marDriftSum / driftSamples : 0.0; }
+    double meanFullMs() const { return fullFrames ? fullMsSum / fullFrames : 0.0; }
+    double meanTrackedMs() const { return trackedFrames ? trackedMsSum / trackedFrames : 0.0; }
+    // 每帧平均延迟相对每帧都完整检测的降低（毫秒）
+    double latencyReductionMs() const;
+    void print(std::ostream& os) const;
+};
 
 class FatigueDetector {
 public:
-    FatigueDetector();
+    FatigueDetector(FatigueDetectorSettings settings = FatigueDetectorSettings());
     bool detect(const cv::Mat& frame, cv::Mat& output);
 
+    void setSettings(const FatigueDetectorSettings& s);
+
+    // 丢弃光流状态，下一帧重新完整检测（例如 ScalerCrop 变化后帧坐标已改变）
+    void resetTracking();
+
+    // 清除跟踪、统计和闭眼/哈欠融合状态，回到刚构造时（例如标定跑完之后）
+    void reset();
+    FatigueDetectorSettings getSettings() const { return settings; }
+    LandmarkTrackingStats getTrackingStats();
+
+    // 最近一次 detect() 的人脸框（帧坐标），未检测到人脸时为空
+    cv::Rect2f lastFace();
+
 private:
     // EAR/MAR计算
-    float eyeAspectRatio(const std::vector<dlib::point>& eye);
-    float mouth_aspect_ratio(const std::vector<cv::Point>& mouth);
+    float eyeAspectRatio(const std::vector<cv::Point2f>& eye);
+    float mouth_aspect_ratio(const std::vector<cv::Point2f>& mouth);
+    // 由 24 个眼/嘴关键点（68 点模型中的 36–59）计算 EAR 和 MAR
+    void landmarkRatios(const std::vector<cv::Point2f>& pts, float& ear, float& mar);
 
     // 状态评估（模糊推理）
     std::map<std::string, double> calculateEBBA(double ear, double eyeClosedDuration);
     std::map<std::string, double> calculateMBBA(double mar, double yawnDuration);
     std::map<std::string, double> combineBBA(const std::map<std::string, double>& bba1, const std::map<std::string, double>& bba2);
 
+    // 关键点获取：完整检测 / 光流跟踪
+    bool fullLandmarks(const cv::Mat& frame, std::vector<cv::Point2f>& pts);
+    bool trackLandmarks(const cv::Mat& frame, std::vector<cv::Point2f>& pts);
+    void storePatch(const cv::Mat& frame, const std::vector<cv::Point2f>& pts);
+    static float interOcular(const std::vector<cv::Point2f>& pts);
+
+    FatigueDetectorSettings settings;
+    std::mutex mutex;
+
     // 人脸检测器和预测器
     dlib::frontal_face_detector detector;
     dlib::shape_predictor predictor;
 
+    // 光流跟踪状态
+    static constexpr int FIRST_TRACKED = 36;
+    static constexpr int NUM_TRACKED = 24;
+    static constexpr int PATCH_MARGIN = 32;
+    std::vector<cv::Point2f> prevPts;
+    cv::Mat prevPatch;
+    cv::Rect prevRoi;
+    bool trackValid = false;
+    unsigned int framesSinceFull = 0;
+    float refInterOcular = 0.0f;
+    cv::Rect2f faceBox;
+    LandmarkTrackingStats stats;
+
     // 卡尔曼滤波器
     cv::KalmanFilter KF;
     cv::Mat_<float> measurement;
@@ -0,0 +1,322 @@
+#include "framebus.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+using namespace FrameBus;
+
+namespace {
+
+uint64_t align(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+BusHeader *header(uint8_t *base) {
+    return reinterpret_cast<BusHeader *>(base);
+}
+
+Cursor *cursors(uint8_t *base) {
+    return reinterpret_cast<Cursor *>(base + align(sizeof(BusHeader), ALIGNMENT));
+}
+
+uint64_t slotsOffset(uint32_t maxConsumers) {
+    return align(align(sizeof(BusHeader), ALIGNMENT) + maxConsumers * sizeof(Cursor), ALIGNMENT);
+}
+
+SlotHeader *slot(uint8_t *base, uint32_t i) {
+    const BusHeader *h = header(base);
+    return reinterpret_cast<SlotHeader *>(base + slotsOffset(h->maxConsumers) + i * h->slotBytes);
+}
+
+uint8_t *slotData(SlotHeader *s) {
+    return reinterpret_cast<uint8_t *>(s) + sizeof(SlotHeader);
+}
+
+std::string shmPath(const std::string &name) {
+    return (!name.empty() && '/' == name[0]) ? name : "/" + name;
+}
+
+bool processAlive(int32_t pid) {
+    if (pid <= 0) return false;
+    return 0 == kill(pid, 0) || EPERM == errno;
+}
+
+/*
+ * The futex is in shared memory, so it must not be a private futex.
+ */
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMs) {
+    struct timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected,
+	    timeoutMs < 0 ? nullptr : &ts, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}
+
+bool FrameBusPublisher::create(const std::string &name, FrameBusSettings settings) {
+    close();
+    if (settings.numSlots < settings.maxConsumers + 2)
+	settings.numSlots = settings.maxConsumers + 2;
+
+    shmName = shmPath(name);
+    shm_unlink(shmName.c_str());
+    int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+	std::cerr << "Can't create frame bus " << shmName << ": " << strerror(errno) << std::endl;
+	return false;
+    }
+
+    const uint64_t slotBytes = align(sizeof(SlotHeader) + settings.maxFrameBytes, ALIGNMENT);
+    length = slotsOffset(settings.maxConsumers) + settings.numSlots * slotBytes;
+    if (ftruncate(fd, length) < 0) {
+	std::cerr << "Can't size frame bus " << shmName << std::endl;
+	::close(fd);
+	shm_unlink(shmName.c_str());
+	return false;
+    }
+    void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == memory) {
+	std::cerr << "Can't map frame bus " << shmName << std::endl;
+	shm_unlink(shmName.c_str());
+	return false;
+    }
+    base = static_cast<uint8_t *>(memory);
+
+    BusHeader *h = new (base) BusHeader();
+    h->numSlots = settings.numSlots;
+    h->maxConsumers = settings.maxConsumers;
+    h->slotBytes = slotBytes;
+    h->publisherPid = getpid();
+    h->latestSlot = NO_SLOT;
+    h->latestSeq = 0;
+    h->futex = 0;
+    for (uint32_t i = 0; i < settings.maxConsumers; i++) {
+	Cursor *c = new (&cursors(base)[i]) Cursor();
+	c->pid = 0;
+	c->pinned = NO_SLOT;
+	c->readSeq = 0;
+	c->dropped = 0;
+    }
+    for (uint32_t i = 0; i < settings.numSlots; i++)
+	new (slot(base, i)) SlotHeader();
+
+    // consumers only attach once they see the magic
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(h->magic, MAGIC, sizeof(h->magic));
+    sequence = 0;
+    lastSlot = 0;
+    tooLargeReported = false;
+    return true;
+}
+
+void FrameBusPublisher::close() {
+    if (nullptr == base) return;
+    header(base)->publisherPid = 0;
+    futexWake(&header(base)->futex);
+    munmap(base, length);
+    shm_unlink(shmName.c_str());
+    base = nullptr;
+    length = 0;
+}
+
+bool FrameBusPublisher::publish(const cv::Mat &frame, uint64_t frameId, int64_t timestamp) {
+    if (nullptr == base || frame.empty()) return false;
+    BusHeader *h = header(base);
+
+    const size_t lineBytes = frame.cols * frame.elemSize();
+    const size_t bytes = lineBytes * frame.rows;
+    if (sizeof(SlotHeader) + bytes > h->slotBytes) {
+	if (!tooLargeReported)
+	    std::cerr << "Frame too large for the frame bus: " << frame.cols << "x" << frame.rows
+		      << ", " << bytes << " bytes > " << h->slotBytes - sizeof(SlotHeader) << std::endl;
+	tooLargeReported = true;
+	return false;
+    }
+
+    /*
+     * Claim a slot: mark it as being written, then check that no consumer
+     * has it pinned. A consumer pins first and then checks the slot, so
+     * one of both always sees the other.
+     */
+    SlotHeader *s = nullptr;
+    uint32_t chosen = NO_SLOT;
+    const uint32_t latest = h->latestSlot;
+    for (uint32_t k = 1; k <= h->numSlots && NO_SLOT == chosen; k++) {
+	const uint32_t candidate = (lastSlot + k) % h->numSlots;
+	if (candidate == latest) continue;
+	s = slot(base, candidate);
+	const uint64_t old = s->seq;
+	s->seq = old | 1;
+	bool pinned = false;
+	for (uint32_t i = 0; i < h->maxConsumers; i++) {
+	    // the pin of a consumer which has died without detaching doesn't
+	    // count, its cursor is reclaimed by the next consumer attaching
+	    Cursor &c = cursors(base)[i];
+	    const int32_t pid = c.pid;
+	    if (0 != pid && c.pinned == candidate && processAlive(pid))
+		pinned = true;
+	}
+	if (pinned)
+	    s->seq = old;
+	else
+	    chosen = candidate;
+    }
+    if (NO_SLOT == chosen) return false;
+
+    s->frameId = frameId;
+    s->timestamp = timestamp;
+    s->width = frame.cols;
+    s->height = frame.rows;
+    s->stride = lineBytes;
+    s->type = frame.type();
+    s->bytes = bytes;
+    uint8_t *dst = slotData(s);
+    if (frame.isContinuous()) {
+	memcpy(dst, frame.data, bytes);
+    } else {
+	for (int i = 0; i < frame.rows; i++, dst += lineBytes)
+	    memcpy(dst, frame.ptr(i), lineBytes);
+    }
+
+    sequence++;
+    s->seq = sequence * 2;
+    h->latestSlot = chosen;
+    h->latestSeq = sequence;
+    h->futex++;
+    futexWake(&h->futex);
+    lastSlot = chosen;
+    return true;
+}
+
+bool FrameBusReader::attach(const std::string &name) {
+    detach();
+    const std::string path = shmPath(name);
+    int fd = shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+	std::cerr << "Can't open frame bus " << path << ": " << strerror(errno) << std::endl;
+	return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(BusHeader)) {
+	::close(fd);
+	return false;
+    }
+    length = st.st_size;
+    void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == memory) return false;
+    base = static_cast<uint8_t *>(memory);
+
+    BusHeader *h = header(base);
+    if (memcmp(h->magic, MAGIC, sizeof(h->magic)) != 0) {
+	std::cerr << path << " is not a frame bus" << std::endl;
+	detach();
+	return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // claim a free cursor or the cursor of a consumer which has died
+    const int32_t self = getpid();
+    for (uint32_t i = 0; i < h->maxConsumers && nullptr == cursor; i++) {
+	Cursor &c = cursors(base)[i];
+	int32_t owner = c.pid;
+	if (0 != owner && processAlive(owner)) continue;
+	if (c.pid.compare_exchange_strong(owner, self))
+	    cursor = &c;
+    }
+    if (nullptr == cursor) {
+	std::cerr << "Too many consumers on " << path << std::endl;
+	detach();
+	return false;
+    }
+    cursor->pinned = NO_SLOT;
+    cursor->dropped = 0;
+    // the first next() returns the latest frame without counting drops
+    const uint64_t latest = h->latestSeq;
+    cursor->readSeq = latest > 0 ? latest - 1 : 0;
+    return true;
+}
+
+void FrameBusReader::detach() {
+    if (nullptr != cursor) {
+	cursor->pinned = NO_SLOT;
+	cursor->pid = 0;
+	cursor = nullptr;
+    }
+    if (nullptr != base)
+	munmap(base, length);
+    base = nullptr;
+    length = 0;
+}
+
+void FrameBusReader::release() {
+    if (nullptr != cursor)
+	cursor->pinned = NO_SLOT;
+}
+
+bool FrameBusReader::next(FrameBusFrame &frame, int timeoutMs) {
+    if (nullptr == cursor) return false;
+    release();
+    BusHeader *h = header(base);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    for (;;) {
+	const uint32_t wakeups = h->futex;
+	const uint64_t latest = h->latestSeq;
+	if (latest > cursor->readSeq) {
+	    const uint32_t si = h->latestSlot;
+	    if (si < h->numSlots) {
+		cursor->pinned = si;
+		SlotHeader *s = slot(base, si);
+		if (s->seq == latest * 2) {
+		    const uint64_t missed = latest - cursor->readSeq - 1;
+		    cursor->dropped += missed;
+		    cursor->readSeq = latest;
+		    frame.sequence = latest;
+		    frame.frameId = s->frameId;
+		    frame.timestamp = s->timestamp;
+		    frame.dropped = missed;
+		    frame.image = cv::Mat(s->height, s->width, s->type, slotData(s), s->stride);
+		    return true;
+		}
+		// overtaken by the publisher, try the newer frame
+		cursor->pinned = NO_SLOT;
+	    }
+	    continue;
+	}
+
+	int waitMs = -1;
+	if (timeoutMs >= 0) {
+	    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+		deadline - std::chrono::steady_clock::now()).count();
+	    if (left <= 0) return false;
+	    waitMs = left;
+	}
+	futexWait(&h->futex, wakeups, waitMs);
+    }
+}
+
+uint64_t FrameBusReader::dropped() const {
+    return nullptr == cursor ? 0 : cursor->dropped.load();
+}
+
+bool FrameBusReader::publisherAlive() const {
+    return nullptr != base && processAlive(header(base)->publisherPid);
+}
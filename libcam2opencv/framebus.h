@@ -0,0 +1,190 @@
+#ifndef __LIBCAM2OPENCV_FRAMEBUS
+#define __LIBCAM2OPENCV_FRAMEBUS
+
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+/*
+ * --------------------------------------------------------------------
+ * Shared memory frame bus
+ *
+ * One publisher (normally the capture process) writes frames into a
+ * ring of slots in a POSIX shared memory object. Any number of consumers
+ * (up to maxConsumers) in other processes attach to it and get the
+ * frames as cv::Mat views straight into the shared memory.
+ *
+ *   +-----------+-----------+-----------+-----+-----------+
+ *   | BusHeader | cursors[] | slot 0    | ... | slot N-1  |
+ *   +-----------+-----------+-----------+-----+-----------+
+ *
+ * The publisher never waits for a consumer: a consumer always gets the
+ * latest frame and the frames it has missed are counted as dropped
+ * (latest frame wins). A consumer pins the slot it is reading and the
+ * publisher skips pinned slots, so a view stays valid until the next
+ * call to next() or release(). Slots pinned by a consumer which has died
+ * are reclaimed.
+ */
+namespace FrameBus {
+    static constexpr char MAGIC[8] = { 'L','2','C','V','B','U','S','2' };
+    static constexpr uint32_t ALIGNMENT = 64;
+    static constexpr uint32_t NO_SLOT = 0xffffffff;
+
+    /*
+     * The pid is the ownership token: a consumer claims a free cursor by
+     * swapping 0 for its pid and a cursor of a dead consumer by swapping
+     * the dead pid for its own, so a claimed cursor never shows pid 0.
+     */
+    struct alignas(64) Cursor {
+	std::atomic<int32_t> pid;        // owner or 0 if free
+	std::atomic<uint32_t> pinned;    // slot being read or NO_SLOT
+	std::atomic<uint64_t> readSeq;   // last sequence number read
+	std::atomic<uint64_t> dropped;   // frames skipped by latest frame wins
+    };
+
+    struct alignas(64) SlotHeader {
+	std::atomic<uint64_t> seq;       // odd while being written
+	uint64_t frameId;
+	int64_t timestamp;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	int32_t type;                    // OpenCV type
+	uint32_t bytes;
+    };
+
+    struct alignas(64) BusHeader {
+	char magic[8];
+	uint32_t numSlots;
+	uint32_t maxConsumers;
+	uint64_t slotBytes;              // including the SlotHeader
+	std::atomic<int32_t> publisherPid;
+	std::atomic<uint32_t> latestSlot;
+	std::atomic<uint64_t> latestSeq; // 0: nothing published yet
+	std::atomic<uint32_t> futex;     // incremented with every frame
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+		  std::atomic<uint32_t>::is_always_lock_free,
+		  "shared memory atomics must be lock free");
+}
+
+/**
+ * Settings of the frame bus
+ **/
+struct FrameBusSettings {
+    /**
+     * Number of frame slots. Needs to be at least maxConsumers + 2 so
+     * that there is always a slot which isn't pinned.
+     **/
+    unsigned int numSlots = 6;
+
+    /**
+     * Largest frame in bytes, e.g. 800x600 BGR.
+     **/
+    size_t maxFrameBytes = 800 * 600 * 3;
+
+    /**
+     * Maximum number of consumers attached at the same time
+     **/
+    unsigned int maxConsumers = 4;
+};
+
+/**
+ * Creates the shared memory object and publishes frames into it.
+ **/
+class FrameBusPublisher {
+public:
+    ~FrameBusPublisher() { close(); }
+
+    /**
+     * Creates (or replaces) the bus "/name". Returns false on error.
+     **/
+    bool create(const std::string &name, FrameBusSettings settings = FrameBusSettings());
+
+    /**
+     * Unmaps and removes the bus.
+     **/
+    void close();
+
+    /**
+     * Copies the frame into a free slot and makes it the latest one.
+     * Never blocks. Returns false if the frame doesn't fit, which is
+     * reported once.
+     **/
+    bool publish(const cv::Mat &frame, uint64_t frameId, int64_t timestamp);
+
+    /**
+     * Sequence number of the last published frame
+     **/
+    uint64_t published() const { return sequence; }
+
+private:
+    std::string shmName;
+    uint8_t *base = nullptr;
+    size_t length = 0;
+    uint64_t sequence = 0;
+    uint32_t lastSlot = 0;
+    bool tooLargeReported = false;
+};
+
+/**
+ * A frame read from the bus. The image points into shared memory.
+ **/
+struct FrameBusFrame {
+    cv::Mat image;
+    uint64_t sequence = 0;
+    uint64_t frameId = 0;
+    int64_t timestamp = 0;
+    uint64_t dropped = 0;     // frames this consumer has missed before this one
+};
+
+/**
+ * Consumer side of the bus: attaches from any process.
+ **/
+class FrameBusReader {
+public:
+    ~FrameBusReader() { detach(); }
+
+    /**
+     * Attaches to the bus "/name" and claims a consumer cursor.
+     **/
+    bool attach(const std::string &name);
+
+    /**
+     * Releases the cursor and unmaps the bus.
+     **/
+    void detach();
+
+    /**
+     * Waits up to timeoutMs (negative: forever) for a frame newer than
+     * the previous one and returns a view of it. The previous view
+     * becomes invalid. Returns false on timeout.
+     **/
+    bool next(FrameBusFrame &frame, int timeoutMs = -1);
+
+    /**
+     * Unpins the current frame so that the publisher can reuse its slot.
+     **/
+    void release();
+
+    /**
+     * Total number of frames this consumer has missed
+     **/
+    uint64_t dropped() const;
+
+    /**
+     * True if the publisher process is running
+     **/
+    bool publisherAlive() const;
+
+private:
+    uint8_t *base = nullptr;
+    size_t length = 0;
+    FrameBus::Cursor *cursor = nullptr;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Headless capture process: publishes the camera frames on the frame bus
+ * so that detection, display and recording can run in other processes.
+ *
+ * Usage: framebus-capture [bus name] [width] [height] [framerate]
+ */
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+
+#include "libcam2opencv.h"
+#include "framebus.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) {
+    running = 0;
+}
+
+int main(int argc, char *argv[]) {
+    const std::string name = argc > 1 ? argv[1] : "fatigue";
+    Libcam2OpenCVSettings settings;
+    settings.width = argc > 2 ? atoi(argv[2]) : 800;
+    settings.height = argc > 3 ? atoi(argv[3]) : 600;
+    settings.framerate = argc > 4 ? atoi(argv[4]) : 30;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Libcam2OpenCV camera;
+    camera.start(settings);
+
+    // the camera may have adjusted the requested size
+    const cv::Size size = camera.frameSize();
+    FrameBusSettings busSettings;
+    busSettings.maxFrameBytes = (size_t)size.width * size.height * 3;
+    FrameBusPublisher bus;
+    if (!bus.create(name, busSettings)) {
+	camera.stop();
+	return 1;
+    }
+    camera.registerFrameBus(&bus);
+    while (running)
+	pause();
+    camera.stop();
+    std::cerr << "Published " << bus.published() << " frames" << std::endl;
+    return 0;
+}
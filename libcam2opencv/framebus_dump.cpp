@@ -0,0 +1,62 @@
+/*
+ * Minimal frame bus consumer: attaches, checks that frames arrive in
+ * order and prints the frame rate, latency and drops once per second.
+ * Give it a per-frame delay in ms to simulate a slow consumer.
+ *
+ * Usage: framebus-dump [bus name] [delay ms]
+ */
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "framebus.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) {
+    running = 0;
+}
+
+int main(int argc, char *argv[]) {
+    const std::string name = argc > 1 ? argv[1] : "fatigue";
+    const int delayMs = argc > 2 ? atoi(argv[2]) : 0;
+
+    FrameBusReader reader;
+    if (!reader.attach(name)) return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    FrameBusFrame frame;
+    uint64_t lastSequence = 0;
+    unsigned long frames = 0, outOfOrder = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    while (running) {
+	if (!reader.next(frame, 1000)) {
+	    if (!reader.publisherAlive()) {
+		std::cerr << "Publisher has gone" << std::endl;
+		break;
+	    }
+	    continue;
+	}
+	if (frame.sequence <= lastSequence) outOfOrder++;
+	lastSequence = frame.sequence;
+	frames++;
+	if (delayMs > 0)
+	    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+
+	const auto now = std::chrono::steady_clock::now();
+	const double dt = std::chrono::duration<double>(now - t0).count();
+	if (dt >= 1.0) {
+	    std::cout << frame.image.cols << "x" << frame.image.rows
+		      << " frame " << frame.frameId
+		      << " " << frames / dt << " fps, dropped " << reader.dropped()
+		      << ", out of order " << outOfOrder << std::endl;
+	    frames = 0;
+	    t0 = now;
+	}
+    }
+    return outOfOrder > 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Synthetic publisher to test frame bus consumers without a camera.
+ * Every frame is filled with a gradient which moves with the frame
+ * number and has the frame number printed on it.
+ *
+ * Usage: framebus-synth [bus name] [width] [height] [framerate]
+ */
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "framebus.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) {
+    running = 0;
+}
+
+int main(int argc, char *argv[]) {
+    const std::string name = argc > 1 ? argv[1] : "fatigue";
+    const int width = argc > 2 ? atoi(argv[2]) : 800;
+    const int height = argc > 3 ? atoi(argv[3]) : 600;
+    const int framerate = argc > 4 ? atoi(argv[4]) : 30;
+
+    FrameBusSettings settings;
+    settings.maxFrameBytes = (size_t)width * height * 3;
+    FrameBusPublisher bus;
+    if (!bus.create(name, settings)) return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    const auto period = std::chrono::microseconds(1000000 / std::max(framerate, 1));
+    auto next = std::chrono::steady_clock::now();
+    const auto t0 = next;
+    cv::Mat frame(height, width, CV_8UC3);
+    for (uint64_t n = 0; running; n++) {
+	for (int y = 0; y < height; y++) {
+	    cv::Vec3b *row = frame.ptr<cv::Vec3b>(y);
+	    for (int x = 0; x < width; x++)
+		row[x] = cv::Vec3b((x + n) & 0xff, (y + n) & 0xff, n & 0xff);
+	}
+	cv::putText(frame, std::to_string(n), cv::Point(20, 60),
+		    cv::FONT_HERSHEY_SIMPLEX, 2.0, cv::Scalar(255, 255, 255), 3);
+	bus.publish(frame, n,
+		    std::chrono::duration_cast<std::chrono::nanoseconds>(next - t0).count());
+	next += period;
+	std::this_thread::sleep_until(next);
+    }
+    std::cerr << "Published " << bus.published() << " frames" << std::endl;
+    return 0;
+}
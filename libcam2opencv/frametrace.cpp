@@ -0,0 +1,189 @@
+#include "frametrace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace FrameTrace {
+
+std::atomic<bool> active{false};
+
+namespace {
+
+struct Event {
+    const char *name;
+    uint64_t frame;
+    int64_t start;
+    int64_t end;
+    char phase;
+};
+
+/*
+ * A ring buffer with a single writer (the thread which owns it). The
+ * exporter reads it without a lock and drops the slots which may have
+ * been overwritten while it was reading. A buffer is one track in the
+ * trace: it keeps the tid and name of its first owner, so short lived
+ * threads which reuse it show up on the same track.
+ */
+struct ThreadBuffer {
+    std::vector<Event> events;
+    std::atomic<uint64_t> head{0};
+    int32_t tid = 0;
+    std::string name;
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+std::vector<ThreadBuffer *> unused;
+size_t capacity = 16384;
+
+/*
+ * Threads which terminate hand their buffer back so that short lived
+ * worker threads don't allocate a new one each.
+ */
+struct Owner {
+    ThreadBuffer *buffer = nullptr;
+    ~Owner() {
+	if (nullptr == buffer) return;
+	std::lock_guard<std::mutex> lock(registryMutex);
+	unused.push_back(buffer);
+    }
+};
+
+thread_local Owner owner;
+thread_local uint64_t currentFrame = 0;
+
+ThreadBuffer *threadBuffer() {
+    if (nullptr != owner.buffer) return owner.buffer;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (!unused.empty()) {
+	owner.buffer = unused.back();
+	unused.pop_back();
+    } else {
+	buffers.push_back(std::make_unique<ThreadBuffer>());
+	owner.buffer = buffers.back().get();
+	owner.buffer->events.resize(capacity);
+	owner.buffer->tid = syscall(SYS_gettid);
+    }
+    return owner.buffer;
+}
+
+void record(const char *name, uint64_t frame, int64_t start, int64_t end, char phase) {
+    ThreadBuffer *b = threadBuffer();
+    const uint64_t h = b->head.load(std::memory_order_relaxed);
+    Event &e = b->events[h % b->events.size()];
+    e.name = name;
+    e.frame = frame;
+    e.start = start;
+    e.end = end;
+    e.phase = phase;
+    b->head.store(h + 1, std::memory_order_release);
+}
+
+void writeString(FILE *f, const std::string &s) {
+    fputc('"', f);
+    for (char c : s) {
+	if ('"' == c || '\\' == c) fputc('\\', f);
+	if ((unsigned char)c < 0x20) continue;
+	fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+}
+
+void enable(size_t eventsPerThread) {
+    {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	if (eventsPerThread > 0) capacity = eventsPerThread;
+    }
+    active = true;
+}
+
+void disable() {
+    active = false;
+}
+
+int64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void setThreadName(const char *name) {
+    ThreadBuffer *b = threadBuffer();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (b->name != name) b->name = name;
+}
+
+void setFrame(uint64_t frame) {
+    currentFrame = frame;
+}
+
+uint64_t frame() {
+    return currentFrame;
+}
+
+void complete(const char *name, uint64_t frame, int64_t start, int64_t end) {
+    if (!enabled()) return;
+    record(name, frame, start, end, 'X');
+}
+
+void instant(const char *name, uint64_t frame) {
+    if (!enabled()) return;
+    const int64_t t = now();
+    record(name, frame, t, t, 'i');
+}
+
+bool exportJson(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (nullptr == f) return false;
+
+    const int pid = getpid();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto &b : buffers) {
+	if (b->name.empty()) continue;
+	fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+		first ? "" : ",\n", pid, b->tid);
+	writeString(f, b->name);
+	fprintf(f, "}}");
+	first = false;
+    }
+
+    std::vector<Event> events;
+    for (const auto &b : buffers) {
+	const uint64_t n = b->events.size();
+	const uint64_t h = b->head.load(std::memory_order_acquire);
+	const uint64_t from = h > n ? h - n : 0;
+	events.clear();
+	for (uint64_t i = from; i < h; i++)
+	    events.push_back(b->events[i % n]);
+	// the writer may have overwritten the oldest slots meanwhile
+	const uint64_t h2 = b->head.load(std::memory_order_acquire);
+	const uint64_t valid = h2 > n ? h2 - n : 0;
+	for (uint64_t i = std::max(from, valid); i < h; i++) {
+	    const Event &e = events[i - from];
+	    fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+	    writeString(f, e.name);
+	    if ('X' == e.phase)
+		fprintf(f, ",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+			e.start / 1000.0, (e.end - e.start) / 1000.0);
+	    else
+		fprintf(f, ",\"cat\":\"frame\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", e.start / 1000.0);
+	    fprintf(f, ",\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%llu}}",
+		    pid, b->tid, (unsigned long long)e.frame);
+	    first = false;
+	}
+    }
+    fprintf(f, "\n]}\n");
+    return 0 == fclose(f);
+}
+
+}
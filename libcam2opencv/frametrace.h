@@ -0,0 +1,97 @@
+#ifndef __LIBCAM2OPENCV_FRAMETRACE
+#define __LIBCAM2OPENCV_FRAMETRACE
+
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * --------------------------------------------------------------------
+ * Per-frame latency tracing
+ *
+ * Spans are tagged with a frame ID and the thread which recorded them
+ * and written into a ring buffer owned by that thread, so recording
+ * takes no lock. When tracing is off a span costs one atomic load.
+ *
+ * The result is exported as Chrome trace-event JSON which can be opened
+ * in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Timestamps are CLOCK_MONOTONIC in ns, the clock of the V4L2 buffer
+ * timestamps which libcamera reports in FrameMetadata::timestamp, so the
+ * exposure can be put on the same time axis.
+ */
+namespace FrameTrace {
+    /**
+     * Starts recording. Each thread keeps its last eventsPerThread spans.
+     **/
+    void enable(size_t eventsPerThread = 16384);
+
+    /**
+     * Stops recording. The recorded spans are kept for export.
+     **/
+    void disable();
+
+    extern std::atomic<bool> active;
+    inline bool enabled() {
+	return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * CLOCK_MONOTONIC in ns
+     **/
+    int64_t now();
+
+    /**
+     * Names the calling thread in the trace. Threads which reuse the
+     * buffer of a terminated thread share its track and name.
+     **/
+    void setThreadName(const char *name);
+
+    /**
+     * The frame the calling thread is working on. Spans without an
+     * explicit frame ID are tagged with it.
+     **/
+    void setFrame(uint64_t frame);
+    uint64_t frame();
+
+    /**
+     * Records a span which started at 'start' and ended at 'end'.
+     * 'name' must be a string literal or otherwise outlive the export.
+     **/
+    void complete(const char *name, uint64_t frame, int64_t start, int64_t end);
+
+    /**
+     * Records a point in time, for example a dropped frame.
+     **/
+    void instant(const char *name, uint64_t frame);
+
+    /**
+     * Writes all threads' spans as Chrome trace-event JSON.
+     **/
+    bool exportJson(const std::string &filename);
+
+    /**
+     * Records the lifetime of the object as a span of the current frame.
+     **/
+    class Span {
+    public:
+	explicit Span(const char *n) : name(n), start(enabled() ? now() : 0) {}
+	Span(const char *n, uint64_t f) : name(n), frameId(f), explicitFrame(true),
+					  start(enabled() ? now() : 0) {}
+	~Span() {
+	    if (start != 0 && enabled())
+		complete(name, explicitFrame ? frameId : frame(), start, now());
+	}
+	Span(const Span &) = delete;
+	Span &operator=(const Span &) = delete;
+    private:
+	const char *name;
+	uint64_t frameId = 0;
+	bool explicitFrame = false;
+	int64_t start;
+    };
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "libcam2opencv.h"
+#include "recording.h"
+#include "frametrace.h"
+#include "framebus.h"
 
 void Libcam2OpenCV::requestComplete(libcamera::Request *request) {
     if (nullptr == request) return;
@@ -31,17 +34,40 @@ void Libcam2OpenCV::requestComplete(libcamera::Request *request) {
     const libcamera::Request::BufferMap &buffers = request->buffers();
     for (auto bufferPair : buffers) {
 	libcamera::FrameBuffer *buffer = bufferPair.second;
+	const uint64_t frameId = buffer->metadata().sequence;
+	if (FrameTrace::enabled()) {
+	    FrameTrace::setThreadName("libcamera");
+	    // the V4L2 buffer timestamp is CLOCK_MONOTONIC, like FrameTrace::now()
+	    FrameTrace::complete("sensor to requestComplete", frameId,
+				 buffer->metadata().timestamp, FrameTrace::now());
+	}
+	FrameTrace::setFrame(frameId);
+	FrameTrace::Span span("requestComplete");
 	libcamera::StreamConfiguration &streamConfig = config->at(0);
 	unsigned int vw = streamConfig.size.width;
 	unsigned int vh = streamConfig.size.height;
 	unsigned int vstr = streamConfig.stride;
 	auto mem = Mmap(buffer);
+	if (nullptr != recorder) {
+	    // the raw buffer as delivered, including the stride and all planes
+	    size_t bytes = streamConfig.frameSize ? streamConfig.frameSize : vstr * vh;
+	    bytes = std::min(bytes, mem[0].size());
+	    recorder->record(mem[0].data(), bytes, vw, vh, vstr,
+			     streamConfig.pixelFormat.fourcc(),
+			     buffer->metadata().sequence,
+			     buffer->metadata().timestamp,
+			     requestMetadata);
+	}
 	frame.create(vh,vw,CV_8UC3);
 	uint ls = vw*3;
 	uint8_t *ptr = mem[0].data();
 	for (unsigned int i = 0; i < vh; i++, ptr += vstr) {
 	    memcpy(frame.ptr(i),ptr,ls);
 	}
+	FrameBusPublisher* bus = frameBus;
+	if (nullptr != bus) {
+	    bus->publish(frame, frameId, buffer->metadata().timestamp);
+	}
 	if (nullptr != callback) {
 	    callback->hasFrame(frame, requestMetadata);
 	}
@@ -54,9 +80,34 @@ void Libcam2OpenCV::requestComplete(libcamera::Request *request) {
 	return;
     /* Re-queue the Request to the camera. */
     request->reuse(libcamera::Request::ReuseBuffers);
+    if (faceCrop) {
+	std::lock_guard<std::mutex> lock(cropMutex);
+	if (cropChanged) {
+	    const cv::Rect c = cropController.crop();
+	    request->controls().set(libcamera::controls::ScalerCrop,
+				    libcamera::Rectangle(c.x, c.y, c.width, c.height));
+	    cropChanged = false;
+	}
+    }
     camera->queueRequest(request);
 }
 
+void Libcam2OpenCV::followFace(const cv::Rect2f &face, const cv::Rect &frameCrop, const cv::Size &frameSize) {
+    if (!faceCrop) return;
+    std::lock_guard<std::mutex> lock(cropMutex);
+    const cv::Rect crop = frameCrop.empty() ? cropController.crop() : frameCrop;
+    const cv::Rect2f sensorFace = face.empty() ? cv::Rect2f() :
+	ScalerCropController::frameToSensor(face, crop, frameSize);
+    if (cropController.update(sensorFace))
+	cropChanged = true;
+}
+
+cv::Rect Libcam2OpenCV::scalerCrop(const libcamera::ControlList &metadata) {
+    const auto crop = metadata.get(libcamera::controls::ScalerCrop);
+    if (!crop) return cv::Rect();
+    return cv::Rect(crop->x, crop->y, crop->width, crop->height);
+}
+
 void Libcam2OpenCV::start(Libcam2OpenCVSettings settings) {
     /*
      * --------------------------------------------------------------------
@@ -329,6 +380,27 @@ void Libcam2OpenCV::start(Libcam2OpenCVSettings settings) {
     controls.set(libcamera::controls::Brightness,settings.brightness);
     controls.set(libcamera::controls::Contrast,settings.contrast);
 
+    /*
+     * The ScalerCrop limits tell us the full sensor area in the
+     * coordinates which the crop rectangle is expressed in.
+     */
+    faceCrop = false;
+    if (settings.faceCrop) {
+	auto cropInfo = camera->controls().find(&libcamera::controls::ScalerCrop);
+	if (cropInfo != camera->controls().end()) {
+	    const libcamera::Rectangle area = cropInfo->second.max().get<libcamera::Rectangle>();
+	    std::lock_guard<std::mutex> lock(cropMutex);
+	    cropController.configure(cv::Rect(area.x, area.y, area.width, area.height),
+				     cv::Size(streamConfig.size.width, streamConfig.size.height),
+				     settings.faceCropMargin, settings.faceCropHysteresis,
+				     settings.faceCropMinSize, settings.faceCropLostFrames);
+	    cropChanged = false;
+	    faceCrop = true;
+	} else {
+	    std::cerr << "The camera doesn't support ScalerCrop." << std::endl;
+	}
+    }
+
     /*
      * --------------------------------------------------------------------
      * Start Capture
@@ -360,3 +432,9 @@ void Libcam2OpenCV::stop() {
     cm->stop();
     delete allocator;
 }
+
+cv::Size Libcam2OpenCV::frameSize() const {
+    if (!config || config->empty()) return cv::Size();
+    const libcamera::StreamConfiguration &streamConfig = config->at(0);
+    return cv::Size(streamConfig.size.width, streamConfig.size.height);
+}
@@ -8,12 +8,14 @@
  * Copyright (C) 2021, kbarni https://github.com/kbarni/
  */
 
+#include <atomic>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <chrono>
 #include <thread>
 #include <memory>
+#include <mutex>
 #include <sys/mman.h>
 #include <opencv2/opencv.hpp>
 
@@ -25,6 +27,11 @@
 
 #include <libcamera/libcamera.h>
 
+#include "scalercrop.h"
+
+class Libcam2OpenCVRecorder;
+class FrameBusPublisher;
+
 /**
  * Settings
  **/
@@ -53,6 +60,33 @@ struct Libcam2OpenCVSettings {
      * Contrast
      **/
     float contrast = 1.0;
+
+    /**
+     * Follow the face with the ScalerCrop control (see followFace()).
+     * The ISP then delivers the face region at the configured output size,
+     * so a smaller width/height still gives enough pixels on the face.
+     **/
+    bool faceCrop = false;
+
+    /**
+     * Fraction of the face size added on each side of the crop
+     **/
+    float faceCropMargin = 0.6f;
+
+    /**
+     * Relative movement or size change of the face needed to move the crop
+     **/
+    float faceCropHysteresis = 0.15f;
+
+    /**
+     * Smallest crop as a fraction of the full sensor width
+     **/
+    float faceCropMinSize = 0.25f;
+
+    /**
+     * Frames without a face after which the full sensor area is restored
+     **/
+    unsigned int faceCropLostFrames = 15;
 };
 
 class Libcam2OpenCV {
@@ -69,6 +103,23 @@ public:
 	callback = cb;
     }
 
+    /**
+     * Register a recorder which gets the raw frames and metadata
+     * before they are converted for the callback. Null disables recording.
+     **/
+    void registerRecorder(Libcam2OpenCVRecorder* r) {
+	recorder = r;
+    }
+
+    /**
+     * Register a frame bus which gets every frame so that consumers
+     * in other processes can use it. Null disables publishing. Can be
+     * called after start() so that the bus can be sized by frameSize().
+     **/
+    void registerFrameBus(FrameBusPublisher* bus) {
+	frameBus = bus;
+    }
+
     /**
      * Starts the camera and the callback at default resolution and framerate
      **/
@@ -78,6 +129,27 @@ public:
      * Stops the camera and the callback
      **/
     void stop();
+
+    /**
+     * Size of the frames delivered to the callback: the validated
+     * stream size, which may differ from the requested one.
+     * Empty before start().
+     **/
+    cv::Size frameSize() const;
+
+    /**
+     * Feeds the face found in a frame (in frame coordinates, empty if
+     * none) which has been captured with the crop 'frameCrop' (see
+     * scalerCrop()). The new crop is set on the next queued request.
+     * Does nothing unless faceCrop has been enabled in the settings.
+     **/
+    void followFace(const cv::Rect2f &face, const cv::Rect &frameCrop, const cv::Size &frameSize);
+
+    /**
+     * The ScalerCrop a frame has been captured with, in sensor
+     * coordinates. Empty if the metadata doesn't report one.
+     **/
+    static cv::Rect scalerCrop(const libcamera::ControlList &metadata);
     
 private:
     std::shared_ptr<libcamera::Camera> camera;
@@ -85,11 +157,17 @@ private:
     std::unique_ptr<libcamera::CameraConfiguration> config;
     cv::Mat frame;
     Callback* callback = nullptr;
+    Libcam2OpenCVRecorder* recorder = nullptr;
+    std::atomic<FrameBusPublisher*> frameBus{nullptr};
     libcamera::FrameBufferAllocator* allocator = nullptr;
     libcamera::Stream *stream = nullptr;
     std::unique_ptr<libcamera::CameraManager> cm;
     std::vector<std::unique_ptr<libcamera::Request>> requests;
     libcamera::ControlList controls;
+    bool faceCrop = false;
+    ScalerCropController cropController;
+    std::mutex cropMutex;
+    bool cropChanged = false;
 
     std::vector<libcamera::Span<uint8_t>> Mmap(libcamera::FrameBuffer *buffer) const
     {
@@ -0,0 +1,398 @@
+#include "recording.h"
+#include "frametrace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace Libcam2OpenCVRecording;
+
+bool Libcam2OpenCVRecorder::start(const std::string &filename, Libcam2OpenCVRecorderSettings s) {
+    stop();
+    settings = s;
+    if (settings.maxQueuedFrames < 1) settings.maxQueuedFrames = 1;
+
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	std::cerr << "Can't create recording " << filename << std::endl;
+	return false;
+    }
+
+    FileHeader header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.alignment = ALIGNMENT;
+    fileOffset = 0;
+    if (!writeAll(&header, sizeof(header)) || !pad(align(fileOffset, ALIGNMENT))) {
+	::close(fd);
+	fd = -1;
+	return false;
+    }
+
+    /*
+     * The slots are allocated once here. Their pixel buffers grow to the
+     * frame size with the first frames and are reused from then on.
+     */
+    slots.assign(settings.maxQueuedFrames, Slot());
+    freeSlots.clear();
+    for (size_t i = 0; i < slots.size(); i++)
+	freeSlots.push_back(i);
+    queued.clear();
+    index.clear();
+    written = 0;
+    dropped = 0;
+
+    failed = false;
+    running = true;
+    writer = std::thread(&Libcam2OpenCVRecorder::writerThread, this);
+    return true;
+}
+
+void Libcam2OpenCVRecorder::stop() {
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!running) return;
+	running = false;
+    }
+    cv.notify_all();
+    writer.join();
+
+    Footer footer = {};
+    memcpy(footer.magic, FOOTER_MAGIC, sizeof(footer.magic));
+    footer.indexOffset = fileOffset;
+    footer.count = index.size();
+    if (!writeAll(index.data(), index.size() * sizeof(IndexEntry)) ||
+	!writeAll(&footer, sizeof(footer)))
+	std::cerr << "Can't write the recording index" << std::endl;
+    ::close(fd);
+    fd = -1;
+    if (dropped > 0)
+	std::cerr << "Recorder dropped " << dropped << " frames" << std::endl;
+}
+
+bool Libcam2OpenCVRecorder::record(const uint8_t *data, size_t bytes,
+				   unsigned int width, unsigned int height, unsigned int stride,
+				   uint32_t pixelFormat, uint64_t sequence, int64_t timestamp,
+				   const libcamera::ControlList &metadata) {
+    size_t s;
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!running) return false;
+	if (failed || freeSlots.empty()) {
+	    dropped++;
+	    return false;
+	}
+	s = freeSlots.back();
+	freeSlots.pop_back();
+    }
+
+    // the slot is owned by this thread until it is queued
+    Slot &slot = slots[s];
+    slot.controls.clear();
+    auto addControl = [&slot](unsigned int id, const libcamera::ControlValue &value) {
+	const libcamera::Span<const uint8_t> payload = value.data();
+	ControlEntry entry = {};
+	entry.id = id;
+	entry.type = value.type();
+	entry.isArray = value.isArray();
+	entry.numElements = value.numElements();
+	entry.bytes = payload.size();
+	const uint8_t *e = reinterpret_cast<const uint8_t *>(&entry);
+	slot.controls.insert(slot.controls.end(), e, e + sizeof(entry));
+	slot.controls.insert(slot.controls.end(), payload.begin(), payload.end());
+	slot.controls.resize(align(slot.controls.size(), 4), 0);
+    };
+    if (settings.controlIds.empty()) {
+	for (const auto &control : metadata)
+	    addControl(control.first, control.second);
+    } else {
+	for (unsigned int id : settings.controlIds)
+	    if (metadata.contains(id))
+		addControl(id, metadata.get(id));
+    }
+
+    FrameHeader &header = slot.header;
+    header = {};
+    memcpy(header.magic, FRAME_MAGIC, sizeof(header.magic));
+    header.controlsBytes = slot.controls.size();
+    header.sequence = sequence;
+    header.timestamp = timestamp;
+    header.width = width;
+    header.height = height;
+    header.stride = stride;
+    header.pixelFormat = pixelFormat;
+    header.dataOffset = align(sizeof(FrameHeader) + slot.controls.size(), ALIGNMENT);
+    header.dataBytes = bytes;
+    slot.data.resize(bytes);
+    memcpy(slot.data.data(), data, bytes);
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	queued.push_back(s);
+    }
+    cv.notify_one();
+    return true;
+}
+
+void Libcam2OpenCVRecorder::writerThread() {
+    for (;;) {
+	size_t s;
+	{
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock, [this]() { return !queued.empty() || !running; });
+	    if (queued.empty()) return;
+	    s = queued.front();
+	    queued.pop_front();
+	}
+
+	const Slot &slot = slots[s];
+	const uint64_t chunk = fileOffset;
+	bool ok = writeAll(&slot.header, sizeof(slot.header)) &&
+	    writeAll(slot.controls.data(), slot.controls.size()) &&
+	    pad(chunk + slot.header.dataOffset) &&
+	    writeAll(slot.data.data(), slot.data.size()) &&
+	    pad(align(fileOffset, ALIGNMENT));
+	if (ok) {
+	    index.push_back({ chunk, slot.header.timestamp });
+	    written++;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	freeSlots.push_back(s);
+	if (!ok) {
+	    /*
+	     * Cut off the torn chunk so that the index follows the last
+	     * good one and the crash recovery scan doesn't stop at it,
+	     * then drop everything else.
+	     */
+	    if (ftruncate(fd, chunk) < 0 || lseek(fd, chunk, SEEK_SET) < 0)
+		std::cerr << "Can't truncate the recording: " << strerror(errno) << std::endl;
+	    fileOffset = chunk;
+	    failed = true;
+	    dropped += 1 + queued.size();
+	    freeSlots.insert(freeSlots.end(), queued.begin(), queued.end());
+	    queued.clear();
+	    std::cerr << "Recording stopped after " << written << " frames" << std::endl;
+	    return;
+	}
+    }
+}
+
+bool Libcam2OpenCVRecorder::writeAll(const void *buf, size_t n) {
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while (n > 0) {
+	ssize_t r = ::write(fd, p, n);
+	if (r < 0) {
+	    if (errno == EINTR) continue;
+	    std::cerr << "Recording write failed: " << strerror(errno) << std::endl;
+	    return false;
+	}
+	p += r;
+	n -= r;
+	fileOffset += r;
+    }
+    return true;
+}
+
+bool Libcam2OpenCVRecorder::pad(uint64_t to) {
+    static const uint8_t zeros[ALIGNMENT] = {};
+    while (fileOffset < to) {
+	size_t n = std::min<uint64_t>(to - fileOffset, sizeof(zeros));
+	if (!writeAll(zeros, n)) return false;
+    }
+    return true;
+}
+
+bool Libcam2OpenCVReplay::open(const std::string &filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+	std::cerr << "Can't open recording " << filename << std::endl;
+	return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+	::close(fd);
+	return false;
+    }
+    length = st.st_size;
+
+    /*
+     * A private mapping: the pages come straight from the page cache and
+     * an accidental write into a frame only touches a copy.
+     */
+    void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == memory) {
+	std::cerr << "Can't map recording " << filename << std::endl;
+	return false;
+    }
+    base = static_cast<uint8_t *>(memory);
+
+    const FileHeader *header = reinterpret_cast<const FileHeader *>(base);
+    if (memcmp(header->magic, FILE_MAGIC, sizeof(header->magic)) != 0 ||
+	header->version != VERSION || 0 == header->alignment) {
+	std::cerr << filename << " is not a recording" << std::endl;
+	close();
+	return false;
+    }
+
+    auto validChunk = [this](uint64_t offset) {
+	if (offset + sizeof(FrameHeader) > length) return false;
+	const FrameHeader *fh = reinterpret_cast<const FrameHeader *>(base + offset);
+	return memcmp(fh->magic, FRAME_MAGIC, sizeof(fh->magic)) == 0 &&
+	    fh->dataOffset >= sizeof(FrameHeader) + fh->controlsBytes &&
+	    offset + fh->dataOffset + fh->dataBytes <= length;
+    };
+
+    const Footer *footer = length >= sizeof(Footer) ?
+	reinterpret_cast<const Footer *>(base + length - sizeof(Footer)) : nullptr;
+    if (footer && memcmp(footer->magic, FOOTER_MAGIC, sizeof(footer->magic)) == 0 &&
+	footer->indexOffset + footer->count * sizeof(IndexEntry) + sizeof(Footer) == length) {
+	const IndexEntry *entries = reinterpret_cast<const IndexEntry *>(base + footer->indexOffset);
+	for (uint64_t i = 0; i < footer->count; i++)
+	    if (validChunk(entries[i].offset))
+		offsets.push_back(entries[i].offset);
+    } else {
+	// no index: the recording has not been stopped cleanly
+	uint64_t offset = align(sizeof(FileHeader), header->alignment);
+	while (validChunk(offset)) {
+	    offsets.push_back(offset);
+	    const FrameHeader *fh = reinterpret_cast<const FrameHeader *>(base + offset);
+	    offset = align(offset + fh->dataOffset + fh->dataBytes, header->alignment);
+	}
+    }
+    return true;
+}
+
+void Libcam2OpenCVReplay::close() {
+    stop();
+    if (nullptr != base)
+	munmap(base, length);
+    base = nullptr;
+    length = 0;
+    offsets.clear();
+}
+
+Libcam2OpenCVReplayFrame Libcam2OpenCVReplay::frame(size_t i) const {
+    Libcam2OpenCVReplayFrame f;
+    if (i >= offsets.size()) return f;
+
+    uint8_t *chunk = base + offsets[i];
+    const FrameHeader *header = reinterpret_cast<const FrameHeader *>(chunk);
+    f.sequence = header->sequence;
+    f.timestamp = header->timestamp;
+    f.pixelFormat = header->pixelFormat;
+    f.width = header->width;
+    f.height = header->height;
+
+    const uint8_t *c = chunk + sizeof(FrameHeader);
+    const uint8_t *end = c + header->controlsBytes;
+    while (c + sizeof(ControlEntry) <= end) {
+	ControlEntry entry;
+	memcpy(&entry, c, sizeof(entry));
+	c += sizeof(entry);
+	if (c + entry.bytes > end) break;
+	libcamera::ControlValue value;
+	value.reserve(static_cast<libcamera::ControlType>(entry.type), entry.isArray, entry.numElements);
+	if (value.data().size() == entry.bytes) {
+	    memcpy(value.data().data(), c, entry.bytes);
+	    f.metadata.set(entry.id, value);
+	}
+	c += align(entry.bytes, 4);
+    }
+
+    /*
+     * Packed RGB formats are wrapped as multi-channel images with the
+     * recorded stride, everything else (YUV, raw) as a single channel
+     * image covering all planes.
+     */
+    uint8_t *data = chunk + header->dataOffset;
+    const libcamera::PixelFormat format(header->pixelFormat);
+    int type = CV_8UC1;
+    unsigned int rows = header->stride ? header->dataBytes / header->stride : 0;
+    if (format == libcamera::formats::BGR888 || format == libcamera::formats::RGB888) {
+	type = CV_8UC3;
+	rows = header->height;
+    } else if (format == libcamera::formats::XRGB8888 || format == libcamera::formats::XBGR8888) {
+	type = CV_8UC4;
+	rows = header->height;
+    }
+    const size_t cols = (CV_8UC1 == type) ? header->stride : header->width;
+    if (rows > 0 && cols * CV_ELEM_SIZE(type) <= header->stride &&
+	(uint64_t)(rows - 1) * header->stride + cols * CV_ELEM_SIZE(type) <= header->dataBytes)
+	f.image = cv::Mat(rows, cols, type, data, header->stride);
+    return f;
+}
+
+void Libcam2OpenCVReplay::start(bool realtime) {
+    stop();
+    playing = true;
+    player = std::thread(&Libcam2OpenCVReplay::play, this, realtime);
+}
+
+void Libcam2OpenCVReplay::stop() {
+    playing = false;
+    if (player.joinable())
+	player.join();
+}
+
+void Libcam2OpenCVReplay::play(bool realtime) {
+    auto t0 = std::chrono::steady_clock::now();
+    int64_t ts0 = 0;
+    bool started = false;
+    bool warned = false;
+    cv::Mat bgr, i420;
+    for (size_t i = 0; i < size() && playing; i++) {
+	Libcam2OpenCVReplayFrame f = frame(i);
+	if (f.image.empty()) continue;
+
+	// the callback gets BGR like from the camera
+	const libcamera::PixelFormat format(f.pixelFormat);
+	const size_t stride = f.image.step;
+	if (format == libcamera::formats::BGR888) {
+	    bgr = f.image;
+	} else if (format == libcamera::formats::YUV420 &&
+		   f.image.total() >= stride * f.height * 3 / 2) {
+	    /*
+	     * Repack the padded planes (Y with the stride, U and V with half
+	     * of it) into a contiguous I420 image of the visible width.
+	     */
+	    const unsigned int w = f.width, h = f.height;
+	    i420.create(h * 3 / 2, w, CV_8UC1);
+	    const uint8_t *src = f.image.data;
+	    uint8_t *dst = i420.data;
+	    for (unsigned int y = 0; y < h; y++, src += stride, dst += w)
+		memcpy(dst, src, w);
+	    for (unsigned int y = 0; y < h; y++, src += stride / 2, dst += w / 2)
+		memcpy(dst, src, w / 2);
+	    cv::cvtColor(i420, bgr, cv::COLOR_YUV2BGR_I420);
+	} else {
+	    if (!warned)
+		std::cerr << "Replay: can't convert " << format.toString()
+			  << " " << f.width << "x" << f.height << " frames to BGR, skipping them" << std::endl;
+	    warned = true;
+	    continue;
+	}
+
+	if (realtime) {
+	    // pace relative to the first frame which is actually delivered
+	    if (!started) {
+		ts0 = f.timestamp;
+		t0 = std::chrono::steady_clock::now();
+	    }
+	    std::this_thread::sleep_until(t0 + std::chrono::nanoseconds(f.timestamp - ts0));
+	}
+	started = true;
+
+	FrameTrace::setFrame(f.sequence);
+	FrameTrace::Span span("replay");
+	if (nullptr != callback)
+	    callback->hasFrame(bgr, f.metadata);
+    }
+    playing = false;
+}
@@ -0,0 +1,252 @@
+#ifndef __LIBCAM2OPENCV_RECORDING
+#define __LIBCAM2OPENCV_RECORDING
+
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "libcam2opencv.h"
+
+/*
+ * --------------------------------------------------------------------
+ * Raw capture container
+ *
+ * A recording is a single file holding the frames exactly as libcamera
+ * delivered them (including the line stride) together with the sensor
+ * timestamp and a selection of the request metadata:
+ *
+ *   +------------+---------+---------+-----+---------+-------+--------+
+ *   | FileHeader | chunk 0 | chunk 1 | ... | chunk N | index | Footer |
+ *   +------------+---------+---------+-----+---------+-------+--------+
+ *
+ * Each chunk starts with a FrameHeader, followed by the serialised
+ * controls and the pixel data, which starts on an 'alignment' boundary
+ * so that it can be used in place after mmap. The index and footer are
+ * written when the recording is stopped. If they are missing (for
+ * example after a crash in the field) the replay scans the chunks.
+ *
+ * All values are stored in host byte order.
+ */
+namespace Libcam2OpenCVRecording {
+    static constexpr char FILE_MAGIC[8] = { 'L','2','C','V','R','A','W','1' };
+    static constexpr char FRAME_MAGIC[4] = { 'F','R','M','E' };
+    static constexpr char FOOTER_MAGIC[8] = { 'L','2','C','V','I','D','X','1' };
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ALIGNMENT = 64;
+
+    struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t alignment;
+    };
+
+    struct FrameHeader {
+	char magic[4];
+	uint32_t controlsBytes;   // serialised controls following this header
+	uint64_t sequence;        // frame sequence number from libcamera
+	int64_t timestamp;        // sensor timestamp in ns
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t pixelFormat;     // libcamera fourcc
+	uint64_t dataOffset;      // pixel data offset relative to the chunk start
+	uint64_t dataBytes;
+    };
+
+    struct ControlEntry {
+	uint32_t id;
+	uint32_t type;            // libcamera::ControlType
+	uint32_t isArray;
+	uint32_t numElements;
+	uint32_t bytes;           // payload following this entry, padded to 4 bytes
+    };
+
+    struct IndexEntry {
+	uint64_t offset;
+	int64_t timestamp;
+    };
+
+    struct Footer {
+	char magic[8];
+	uint64_t indexOffset;
+	uint64_t count;
+    };
+
+    static_assert(sizeof(FileHeader) == 16, "FileHeader layout");
+    static_assert(sizeof(FrameHeader) == 56, "FrameHeader layout");
+    static_assert(sizeof(ControlEntry) == 20, "ControlEntry layout");
+    static_assert(sizeof(IndexEntry) == 16, "IndexEntry layout");
+    static_assert(sizeof(Footer) == 24, "Footer layout");
+
+    inline uint64_t align(uint64_t v, uint64_t a) {
+	return (v + a - 1) / a * a;
+    }
+}
+
+/**
+ * Settings of the recorder
+ **/
+struct Libcam2OpenCVRecorderSettings {
+    /**
+     * Number of frames which can be queued for the writer thread.
+     * If the writer falls behind, further frames are dropped so that
+     * capture never stalls.
+     **/
+    unsigned int maxQueuedFrames = 8;
+
+    /**
+     * Metadata controls to record. An empty list records all of them.
+     **/
+    std::vector<unsigned int> controlIds = {
+	libcamera::controls::SENSOR_TIMESTAMP,
+	libcamera::controls::EXPOSURE_TIME,
+	libcamera::controls::ANALOGUE_GAIN,
+	libcamera::controls::DIGITAL_GAIN,
+	libcamera::controls::COLOUR_GAINS,
+	libcamera::controls::COLOUR_TEMPERATURE,
+	libcamera::controls::LUX,
+	libcamera::controls::FRAME_DURATION,
+	libcamera::controls::SCALER_CROP
+    };
+};
+
+/**
+ * Records the raw frames and metadata seen by Libcam2OpenCV into a
+ * container file. The actual file I/O is done by a background thread.
+ **/
+class Libcam2OpenCVRecorder {
+public:
+    ~Libcam2OpenCVRecorder() { stop(); }
+
+    /**
+     * Opens the file and starts the writer thread. Returns false if
+     * the file cannot be created.
+     **/
+    bool start(const std::string &filename,
+	       Libcam2OpenCVRecorderSettings settings = Libcam2OpenCVRecorderSettings());
+
+    /**
+     * Flushes the queued frames, writes the index and closes the file.
+     **/
+    void stop();
+
+    /**
+     * Queues one raw frame. Called from the libcamera completion handler
+     * so it only copies into a preallocated slot and never blocks on I/O.
+     * Returns false if the frame has been dropped. After a write error
+     * (e.g. disk full) all further frames are dropped and stop() writes
+     * the index of the frames recorded so far.
+     **/
+    bool record(const uint8_t *data, size_t bytes,
+		unsigned int width, unsigned int height, unsigned int stride,
+		uint32_t pixelFormat, uint64_t sequence, int64_t timestamp,
+		const libcamera::ControlList &metadata);
+
+    unsigned long framesWritten() const { return written; }
+    unsigned long framesDropped() const { return dropped; }
+
+private:
+    struct Slot {
+	Libcam2OpenCVRecording::FrameHeader header;
+	std::vector<uint8_t> controls;
+	std::vector<uint8_t> data;
+    };
+
+    void writerThread();
+    bool writeAll(const void *buf, size_t n);
+    bool pad(uint64_t to);
+
+    Libcam2OpenCVRecorderSettings settings;
+    int fd = -1;
+    uint64_t fileOffset = 0;
+    std::vector<Slot> slots;
+    std::vector<size_t> freeSlots;
+    std::deque<size_t> queued;
+    std::vector<Libcam2OpenCVRecording::IndexEntry> index;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread writer;
+    bool running = false;
+    bool failed = false;      // a write has failed, no more frames are written
+    std::atomic<unsigned long> written{0};
+    std::atomic<unsigned long> dropped{0};
+};
+
+/**
+ * One frame of a recording. The image is a view into the memory mapped
+ * file and is only valid as long as the Libcam2OpenCVReplay is open.
+ **/
+struct Libcam2OpenCVReplayFrame {
+    cv::Mat image;
+    uint64_t sequence = 0;
+    int64_t timestamp = 0;
+    uint32_t pixelFormat = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    libcamera::ControlList metadata{libcamera::controls::controls};
+};
+
+/**
+ * Replays a recording made by Libcam2OpenCVRecorder. The file is memory
+ * mapped and frames are handed out without copying.
+ **/
+class Libcam2OpenCVReplay {
+public:
+    ~Libcam2OpenCVReplay() { close(); }
+
+    /**
+     * Maps the recording. Returns false if it isn't a valid recording.
+     **/
+    bool open(const std::string &filename);
+
+    void close();
+
+    /**
+     * Number of frames in the recording
+     **/
+    size_t size() const { return offsets.size(); }
+
+    /**
+     * Returns frame i. The image has the recorded stride. Writing into it
+     * only changes a private copy of the page, never the file.
+     **/
+    Libcam2OpenCVReplayFrame frame(size_t i) const;
+
+    /**
+     * Register the callback for the frame data
+     **/
+    void registerCallback(Libcam2OpenCV::Callback* cb) {
+	callback = cb;
+    }
+
+    /**
+     * Plays the recording to the callback in a thread, either as fast as
+     * possible or paced by the recorded sensor timestamps.
+     **/
+    void start(bool realtime = true);
+
+    /**
+     * Stops the playback thread
+     **/
+    void stop();
+
+private:
+    void play(bool realtime);
+
+    uint8_t *base = nullptr;
+    size_t length = 0;
+    std::vector<uint64_t> offsets;
+    Libcam2OpenCV::Callback* callback = nullptr;
+    std::thread player;
+    std::atomic<bool> playing{false};
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "scalercrop.h"
+
+#include <algorithm>
+#include <cmath>
+
+void ScalerCropController::configure(const cv::Rect &sensorArea, const cv::Size &outputSize,
+				     float m, float h, float s, unsigned int l) {
+    full = sensorArea;
+    current = full;
+    if (outputSize.width > 0 && outputSize.height > 0)
+	aspect = (float)outputSize.width / (float)outputSize.height;
+    margin = m;
+    hysteresis = h;
+    minSize = s;
+    lostFrames = l;
+    misses = 0;
+}
+
+bool ScalerCropController::update(const cv::Rect2f &face) {
+    if (full.empty()) return false;
+
+    if (face.empty()) {
+	if (++misses >= lostFrames && current != full) {
+	    current = full;
+	    return true;
+	}
+	return false;
+    }
+    misses = 0;
+
+    // grow the face by the margin and match the output aspect ratio
+    float w = face.width * (1.0f + 2.0f * margin);
+    float h = face.height * (1.0f + 2.0f * margin);
+    if (w / h < aspect)
+	w = h * aspect;
+    w = std::max(w, full.width * minSize);
+    w = std::min(w, (float)full.width);
+    h = w / aspect;
+    if (h > full.height) {
+	h = full.height;
+	w = h * aspect;
+    }
+
+    const float cx = face.x + face.width / 2.0f;
+    const float cy = face.y + face.height / 2.0f;
+    const float x = std::clamp(cx - w / 2.0f, (float)full.x, (float)(full.x + full.width) - w);
+    const float y = std::clamp(cy - h / 2.0f, (float)full.y, (float)(full.y + full.height) - h);
+    const cv::Rect desired(std::lround(x), std::lround(y), std::lround(w), std::lround(h));
+
+    /*
+     * Hysteresis: keep the current crop as long as the whole face is in
+     * it and neither the position nor the size would change noticeably.
+     * Every change costs a few frames until the new crop is applied and
+     * restarts the landmark tracking.
+     */
+    const cv::Rect faceInt(std::lround(face.x), std::lround(face.y),
+			   std::lround(face.width), std::lround(face.height));
+    const bool inside = (faceInt & current) == faceInt;
+    const float size = (float)desired.width / (float)current.width;
+    const float dx = std::fabs((desired.x + desired.width / 2.0f) - (current.x + current.width / 2.0f));
+    const float dy = std::fabs((desired.y + desired.height / 2.0f) - (current.y + current.height / 2.0f));
+    if (inside &&
+	size > 1.0f - hysteresis && size < 1.0f + hysteresis &&
+	dx < hysteresis * current.width && dy < hysteresis * current.height)
+	return false;
+
+    if (desired == current) return false;
+    current = desired;
+    return true;
+}
+
+cv::Rect2f ScalerCropController::frameToSensor(const cv::Rect2f &r, const cv::Rect &crop, const cv::Size &frameSize) {
+    if (crop.empty() || frameSize.width <= 0 || frameSize.height <= 0) return r;
+    const float sx = (float)crop.width / frameSize.width;
+    const float sy = (float)crop.height / frameSize.height;
+    return cv::Rect2f(crop.x + r.x * sx, crop.y + r.y * sy, r.width * sx, r.height * sy);
+}
+
+cv::Rect2f ScalerCropController::sensorToFrame(const cv::Rect2f &r, const cv::Rect &crop, const cv::Size &frameSize) {
+    if (crop.empty() || frameSize.width <= 0 || frameSize.height <= 0) return r;
+    const float sx = (float)frameSize.width / crop.width;
+    const float sy = (float)frameSize.height / crop.height;
+    return cv::Rect2f((r.x - crop.x) * sx, (r.y - crop.y) * sy, r.width * sx, r.height * sy);
+}
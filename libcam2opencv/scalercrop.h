@@ -0,0 +1,71 @@
+#ifndef __LIBCAM2OPENCV_SCALERCROP
+#define __LIBCAM2OPENCV_SCALERCROP
+
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Decides the ScalerCrop rectangle which follows a face.
+ *
+ * All rectangles are in sensor coordinates (the coordinate space of
+ * libcamera::controls::ScalerCrop). The crop keeps the aspect ratio of
+ * the output stream so the ISP doesn't distort the image, and it only
+ * moves if the face leaves it or has moved / changed size by more than
+ * the hysteresis.
+ **/
+class ScalerCropController {
+public:
+    /**
+     * Sets the full sensor area and the output size and returns to the
+     * full area.
+     *
+     * margin: fraction of the face size added on each side
+     * hysteresis: relative change of position or size needed to move the crop
+     * minSize: smallest crop as a fraction of the full area
+     * lostFrames: frames without face after which the full area is restored
+     **/
+    void configure(const cv::Rect &sensorArea, const cv::Size &outputSize,
+		   float margin, float hysteresis, float minSize,
+		   unsigned int lostFrames);
+
+    /**
+     * Feeds the face position of one frame. An empty rectangle means no
+     * face was found. Returns true if the crop has changed.
+     **/
+    bool update(const cv::Rect2f &faceInSensor);
+
+    /**
+     * The crop to request
+     **/
+    cv::Rect crop() const { return current; }
+
+    /**
+     * The full sensor area
+     **/
+    cv::Rect fullArea() const { return full; }
+
+    /**
+     * Maps a rectangle in a frame which has been captured with 'crop' and
+     * scaled to 'frameSize' back to sensor coordinates.
+     **/
+    static cv::Rect2f frameToSensor(const cv::Rect2f &r, const cv::Rect &crop, const cv::Size &frameSize);
+
+    /**
+     * Maps a rectangle in sensor coordinates into a frame captured with
+     * 'crop' and scaled to 'frameSize'.
+     **/
+    static cv::Rect2f sensorToFrame(const cv::Rect2f &r, const cv::Rect &crop, const cv::Size &frameSize);
+
+private:
+    cv::Rect full;
+    cv::Rect current;
+    float aspect = 4.0f / 3.0f;
+    float margin = 0.6f;
+    float hysteresis = 0.15f;
+    float minSize = 0.25f;
+    unsigned int lostFrames = 15;
+    unsigned int misses = 0;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "simcamera.h"
+#include "frametrace.h"
+
+#include <deque>
+
+bool Libcam2OpenCVSimCamera::open(const std::string &source) {
+    sensorImage.release();
+    if (!video.open(source)) {
+	std::cerr << "Can't open " << source << std::endl;
+	return false;
+    }
+    return true;
+}
+
+void Libcam2OpenCVSimCamera::setSensorImage(const cv::Mat &image) {
+    video.release();
+    sensorImage = image.clone();
+}
+
+bool Libcam2OpenCVSimCamera::sensorFrame(cv::Mat &out) {
+    if (!sensorImage.empty()) {
+	out = sensorImage;
+	return true;
+    }
+    if (!video.isOpened()) return false;
+    if (video.read(out)) return true;
+    // loop the video
+    video.set(cv::CAP_PROP_POS_FRAMES, 0);
+    return video.read(out);
+}
+
+void Libcam2OpenCVSimCamera::start(Libcam2OpenCVSettings settings) {
+    stop();
+    cv::Mat first;
+    if (!sensorFrame(first)) {
+	std::cerr << "No sensor frames for the simulated camera." << std::endl;
+	return;
+    }
+    if (0 == settings.width || 0 == settings.height) {
+	settings.width = first.cols;
+	settings.height = first.rows;
+    }
+    {
+	std::lock_guard<std::mutex> lock(cropMutex);
+	cropController.configure(cv::Rect(0, 0, first.cols, first.rows),
+				 cv::Size(settings.width, settings.height),
+				 settings.faceCropMargin, settings.faceCropHysteresis,
+				 settings.faceCropMinSize, settings.faceCropLostFrames);
+	faceCrop = settings.faceCrop;
+    }
+    playing = true;
+    thread = std::thread(&Libcam2OpenCVSimCamera::run, this, settings);
+}
+
+void Libcam2OpenCVSimCamera::stop() {
+    playing = false;
+    if (thread.joinable())
+	thread.join();
+}
+
+void Libcam2OpenCVSimCamera::followFace(const cv::Rect2f &face, const cv::Rect &frameCrop, const cv::Size &frameSize) {
+    std::lock_guard<std::mutex> lock(cropMutex);
+    if (!faceCrop) return;
+    const cv::Rect crop = frameCrop.empty() ? cropController.crop() : frameCrop;
+    const cv::Rect2f sensorFace = face.empty() ? cv::Rect2f() :
+	ScalerCropController::frameToSensor(face, crop, frameSize);
+    cropController.update(sensorFace);
+}
+
+cv::Rect Libcam2OpenCVSimCamera::requestedCrop() {
+    std::lock_guard<std::mutex> lock(cropMutex);
+    return cropController.crop();
+}
+
+void Libcam2OpenCVSimCamera::run(Libcam2OpenCVSettings settings) {
+    const auto period = std::chrono::microseconds(settings.framerate > 0 ? 1000000 / settings.framerate : 33333);
+    const cv::Size outputSize(settings.width, settings.height);
+    auto next = std::chrono::steady_clock::now();
+    const auto t0 = next;
+
+    // crops requested but still travelling through the request queue
+    std::deque<cv::Rect> inFlight;
+    cv::Rect applied;
+    cv::Mat sensor, frame;
+    uint64_t sequence = 0;
+    while (playing) {
+	if (!sensorFrame(sensor)) break;
+
+	{
+	    std::lock_guard<std::mutex> lock(cropMutex);
+	    inFlight.push_back(cropController.crop());
+	}
+	if (applied.empty() || inFlight.size() > pipelineDepth) {
+	    applied = inFlight.front();
+	    inFlight.pop_front();
+	}
+	applied &= cv::Rect(0, 0, sensor.cols, sensor.rows);
+	if (applied.empty())
+	    applied = cv::Rect(0, 0, sensor.cols, sensor.rows);
+
+	// the ISP scales the crop to the output size
+	cv::resize(sensor(applied), frame, outputSize, 0, 0, cv::INTER_AREA);
+
+	libcamera::ControlList metadata(libcamera::controls::controls);
+	metadata.set(libcamera::controls::ScalerCrop,
+		     libcamera::Rectangle(applied.x, applied.y, applied.width, applied.height));
+	metadata.set(libcamera::controls::SensorTimestamp,
+		     (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(next - t0).count());
+	FrameTrace::setFrame(sequence++);
+	if (nullptr != callback)
+	    callback->hasFrame(frame, metadata);
+
+	next += period;
+	std::this_thread::sleep_until(next);
+    }
+    playing = false;
+}
@@ -0,0 +1,91 @@
+#ifndef __LIBCAM2OPENCV_SIMCAMERA
+#define __LIBCAM2OPENCV_SIMCAMERA
+
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+#include "libcam2opencv.h"
+
+/**
+ * A camera without hardware: it takes "sensor" frames from a video file
+ * (or a single image) and behaves like Libcam2OpenCV towards the
+ * callback, including the ScalerCrop control. The crop is applied a
+ * few frames after it has been requested, as with the real request
+ * queue, and each frame reports the crop it was made with in its
+ * metadata.
+ **/
+class Libcam2OpenCVSimCamera {
+public:
+    ~Libcam2OpenCVSimCamera() { stop(); }
+
+    /**
+     * Opens the video or image which provides the full sensor frames.
+     **/
+    bool open(const std::string &source);
+
+    /**
+     * Uses a fixed full sensor image.
+     **/
+    void setSensorImage(const cv::Mat &image);
+
+    /**
+     * Register the callback for the frame data
+     **/
+    void registerCallback(Libcam2OpenCV::Callback* cb) {
+	callback = cb;
+    }
+
+    /**
+     * Starts delivering frames at the size and framerate of the settings.
+     * A zero size delivers the full sensor resolution.
+     **/
+    void start(Libcam2OpenCVSettings settings = Libcam2OpenCVSettings());
+
+    /**
+     * Stops the callback
+     **/
+    void stop();
+
+    /**
+     * True while frames are delivered. Becomes false if start() has
+     * found no sensor frame or reading one has failed.
+     **/
+    bool running() const { return playing; }
+
+    /**
+     * Same as Libcam2OpenCV::followFace()
+     **/
+    void followFace(const cv::Rect2f &face, const cv::Rect &frameCrop, const cv::Size &frameSize);
+
+    /**
+     * The crop most recently requested by followFace(), in sensor
+     * coordinates. Frames report the crop they were made with in their
+     * metadata, which lags behind by pipelineDepth frames.
+     **/
+    cv::Rect requestedCrop();
+
+    /**
+     * Number of requests in flight before a new crop takes effect
+     **/
+    unsigned int pipelineDepth = 4;
+
+private:
+    void run(Libcam2OpenCVSettings settings);
+    bool sensorFrame(cv::Mat &out);
+
+    cv::VideoCapture video;
+    cv::Mat sensorImage;
+    Libcam2OpenCV::Callback* callback = nullptr;
+    ScalerCropController cropController;
+    std::mutex cropMutex;
+    bool faceCrop = false;
+    std::thread thread;
+    std::atomic<bool> playing{false};
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Exercises the face-following ScalerCrop loop without a camera: the
+ * simulated camera delivers frames from a video or image, a face which
+ * moves in sensor coordinates is mapped into each delivered frame and
+ * fed back with followFace(). Per frame it prints the requested and the
+ * applied crop and how much of the face the applied crop contains.
+ *
+ * Usage: simcamera-crop <video|image> [frames] [face x,y,w,h] [amplitude]
+ *
+ * The face defaults to a quarter of the sensor width in the centre and
+ * moves horizontally by +-amplitude pixels (default 0.2 of the width).
+ */
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "simcamera.h"
+
+struct CropCallback : Libcam2OpenCV::Callback {
+    Libcam2OpenCVSimCamera* camera = nullptr;
+    cv::Rect2f face;           // face at frame 0, sensor coordinates
+    float amplitude = 0.0f;
+    std::atomic<unsigned int> frames{0};
+    double coverageSum = 0.0;
+
+    virtual void hasFrame(const cv::Mat &frame, const libcamera::ControlList &metadata) {
+	const unsigned int n = frames;
+	const cv::Rect applied = Libcam2OpenCV::scalerCrop(metadata);
+
+	cv::Rect2f sensorFace = face;
+	sensorFace.x += amplitude * std::sin(n * 0.05);
+
+	// what the detector would find in this frame
+	const cv::Rect2f inFrame = ScalerCropController::sensorToFrame(sensorFace, applied, frame.size()) &
+	    cv::Rect2f(0, 0, frame.cols, frame.rows);
+	camera->followFace(inFrame, applied, frame.size());
+
+	const double coverage = (sensorFace & cv::Rect2f(applied)).area() / sensorFace.area();
+	coverageSum += coverage;
+	const cv::Rect requested = camera->requestedCrop();
+	printf("%5u requested %4d,%4d %4dx%-4d applied %4d,%4d %4dx%-4d face coverage %5.1f%%\n",
+	       n, requested.x, requested.y, requested.width, requested.height,
+	       applied.x, applied.y, applied.width, applied.height, coverage * 100.0);
+	frames++;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+	std::cerr << "Usage: " << argv[0] << " <video|image> [frames] [face x,y,w,h] [amplitude]" << std::endl;
+	return 1;
+    }
+    const unsigned int maxFrames = argc > 2 ? atoi(argv[2]) : 200;
+
+    Libcam2OpenCVSimCamera camera;
+    cv::Mat image = cv::imread(argv[1], cv::IMREAD_COLOR);
+    cv::Size sensor;
+    if (!image.empty()) {
+	camera.setSensorImage(image);
+	sensor = image.size();
+    } else {
+	if (!camera.open(argv[1])) return 1;
+	cv::VideoCapture probe(argv[1]);
+	sensor = cv::Size(probe.get(cv::CAP_PROP_FRAME_WIDTH), probe.get(cv::CAP_PROP_FRAME_HEIGHT));
+    }
+
+    CropCallback callback;
+    callback.camera = &camera;
+    callback.face = cv::Rect2f(sensor.width * 3 / 8.0f, sensor.height / 2.0f - sensor.width / 8.0f,
+			       sensor.width / 4.0f, sensor.width / 4.0f);
+    if (argc > 3)
+	sscanf(argv[3], "%f,%f,%f,%f", &callback.face.x, &callback.face.y,
+	       &callback.face.width, &callback.face.height);
+    callback.amplitude = argc > 4 ? atof(argv[4]) : sensor.width * 0.2f;
+    camera.registerCallback(&callback);
+
+    Libcam2OpenCVSettings settings;
+    settings.width = 400;
+    settings.height = 300;
+    settings.framerate = 100;
+    settings.faceCrop = true;
+    camera.start(settings);
+    // the camera stops by itself when it can't read a sensor frame
+    while (callback.frames < maxFrames && camera.running())
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    camera.stop();
+    if (0 == callback.frames) {
+	std::cerr << "The simulated camera hasn't delivered any frames." << std::endl;
+	return 1;
+    }
+
+    std::cout << "Mean face coverage: " << 100.0 * callback.coverageSum / callback.frames
+	      << "% over " << callback.frames << " frames, output "
+	      << settings.width << "x" << settings.height << " from "
+	      << sensor.width << "x" << sensor.height << std::endl;
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "window.h"
 #include "fatigue_detector.h"
+#include "frametrace.h"
+#include "calibration.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <thread>
 #include <QMetaObject>
@@ -9,6 +12,12 @@ FatigueDetector detector;
 
 Window::Window()
 {
+    // 逐帧延迟跟踪（FATIGUE_TRACE=文件），退出时导出 Perfetto 可读的 JSON
+    if (std::getenv("FATIGUE_TRACE")) {
+        FrameTrace::enable();
+        FrameTrace::setThreadName("ui");
+    }
+
     myCallback.window = this;
     camera.registerCallback(&myCallback);
 
@@ -31,21 +40,125 @@ Window::Window()
     settings.width = 800;
     settings.height = 600;
     settings.framerate = 30;
+
+    // 人脸跟随裁剪：ISP 只输出人脸区域，分辨率减半即可保持人脸像素
+    if (std::getenv("FATIGUE_FACE_CROP")) {
+        settings.faceCrop = true;
+        settings.width = 400;
+        settings.height = 300;
+    }
+
+    // 眼/嘴关键点多速率跟踪（FATIGUE_TRACK_LANDMARKS=完整检测间隔，缺省 5）：
+    // 每 N 帧完整检测一次，其余帧光流传播
+    FatigueDetectorSettings detectorSettings;
+    if (const char* interval = std::getenv("FATIGUE_TRACK_LANDMARKS")) {
+        detectorSettings.trackLandmarks = true;
+        if (std::atoi(interval) > 0) detectorSettings.refreshInterval = std::atoi(interval);
+    }
+    detector.setSettings(detectorSettings);
+
+    // 启动自动标定（FATIGUE_CALIBRATE=延迟预算毫秒，缺省 150）：按实测吞吐量
+    // 选择分辨率、帧率和检测设置，结果按机器缓存
+    if (const char* budget = std::getenv("FATIGUE_CALIBRATE")) {
+        CalibrationSettings calibrationSettings;
+        if (std::atof(budget) > 0) calibrationSettings.latencyBudgetMs = std::atof(budget);
+        // 人脸裁剪的输出分辨率不变，只标定检测设置和帧率
+        if (settings.faceCrop)
+            calibrationSettings.resolution = cv::Size(settings.width, settings.height);
+        AutoCalibration calibration(detector, calibrationSettings);
+        AutoCalibration::apply(calibration.calibrate(), settings);
+    }
+
+    // 回放录制文件代替摄像头，按原始时间戳节奏送帧
+    if (const char* replayFile = std::getenv("FATIGUE_REPLAY")) {
+        if (replay.open(replayFile)) {
+            replay.registerCallback(&myCallback);
+            replay.start(true);
+            replaying = true;
+            return;
+        }
+    }
+
+    // 作为帧总线的消费者，摄像头由独立的采集进程运行
+    if (const char* busName = std::getenv("FATIGUE_BUS_ATTACH")) {
+        if (busReader.attach(busName)) {
+            busRunning = true;
+            busThread = std::thread([this]() {
+                const libcamera::ControlList metadata(libcamera::controls::controls);
+                FrameBusFrame frame;
+                while (busRunning) {
+                    if (!busReader.next(frame, 100)) continue;
+                    FrameTrace::setFrame(frame.frameId);
+                    myCallback.hasFrame(frame.image, metadata);
+                    busReader.release();
+                }
+            });
+            return;
+        }
+    }
+
+    if (const char* recordFile = std::getenv("FATIGUE_RECORD")) {
+        if (recorder.start(recordFile))
+            camera.registerRecorder(&recorder);
+    }
     camera.start(settings);
+
+    // 总线按校验后的实际帧尺寸分配，可能与请求的分辨率不同
+    if (const char* busName = std::getenv("FATIGUE_BUS_PUBLISH")) {
+        const cv::Size size = camera.frameSize();
+        FrameBusSettings busSettings;
+        busSettings.maxFrameBytes = (size_t)size.width * size.height * 3;
+        if (busPublisher.create(busName, busSettings))
+            camera.registerFrameBus(&busPublisher);
+    }
 }
 
 Window::~Window()
 {
-    camera.stop();
+    if (replaying) {
+        replay.stop();
+    } else if (busRunning) {
+        busRunning = false;
+        busThread.join();
+        busReader.detach();
+    } else {
+        camera.stop();
+        recorder.stop();
+        busPublisher.close();
+    }
+    detector.getTrackingStats().print(std::cerr);
+
+    if (const char* traceFile = std::getenv("FATIGUE_TRACE")) {
+        FrameTrace::disable();
+        if (!FrameTrace::exportJson(traceFile))
+            std::cerr << "Can't write trace " << traceFile << std::endl;
+    }
 }
 
 // 异步检测图像 + 颜色通道修复
-void Window::updateImage(const cv::Mat &mat) {
+void Window::updateImage(const cv::Mat &mat, const cv::Rect &crop) {
+    const uint64_t frameId = FrameTrace::frame();
+    if (detecting.exchange(true)) {
+        FrameTrace::instant("dropped (detector busy)", frameId);
+        return;
+    }
+    if (crop != lastCrop) {
+        detector.resetTracking();
+        lastCrop = crop;
+    }
     cv::Mat input = mat.clone();
+    const int64_t queued = FrameTrace::now();
 
-    std::thread([this, input]() {
+    std::thread([this, input, crop, frameId, queued]() {
+        FrameTrace::setFrame(frameId);
+        if (FrameTrace::enabled()) {
+            FrameTrace::setThreadName("detect");
+            FrameTrace::complete("detect queue", frameId, queued, FrameTrace::now());
+        }
+        FrameTrace::Span worker("detect worker");
         cv::Mat output;
         bool drowsy = detector.detect(input, output);  // 包括人脸、EAR 等可视元素
+        camera.followFace(detector.lastFace(), crop, input.size());
 
         // ✅ BGR → RGB 颜色转换（防止颜色错乱）
         cv::Mat rgb;
@@ -53,9 +166,13 @@ void Window::updateImage(const cv::Mat &mat) {
 
         // ✅ 构造 Qt 图像格式
         QImage frame(rgb.data, rgb.cols, rgb.rows, rgb.step, QImage::Format_RGB888);
+        detecting = false;
 
         // ✅ 切回主线程更新 UI
-        QMetaObject::invokeMethod(this, [this, frame, drowsy]() {
+        const int64_t posted = FrameTrace::now();
+        QMetaObject::invokeMethod(this, [this, frame, drowsy, frameId, posted]() {
+            FrameTrace::complete("ui queue", frameId, posted, FrameTrace::now());
+            FrameTrace::Span span("ui update", frameId);
             image->setPixmap(QPixmap::fromImage(frame));
 
             const int h = frame.height();
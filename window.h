@@ -7,7 +7,12 @@
 #include <QPushButton>
 #include <QLabel>
 
+#include <atomic>
+#include <thread>
+
 #include "libcam2opencv.h"
+#include "recording.h"
+#include "framebus.h"
 
 // class definition 'Window'
 class Window : public QWidget
@@ -18,7 +23,7 @@ class Window : public QWidget
 public:
     Window();
     ~Window();
-    void updateImage(const cv::Mat &mat);
+    void updateImage(const cv::Mat &mat, const cv::Rect &crop = cv::Rect());
 
     QwtThermo    *thermo;
     QHBoxLayout  *hLayout;  // horizontal layout
@@ -26,15 +31,33 @@ public:
 
     struct MyCallback : Libcam2OpenCV::Callback {
 	Window* window = nullptr;
-	virtual void hasFrame(const cv::Mat &frame, const libcamera::ControlList &) {
+	virtual void hasFrame(const cv::Mat &frame, const libcamera::ControlList &metadata) {
 	    if (nullptr != window) {
-		window->updateImage(frame);
+		window->updateImage(frame, Libcam2OpenCV::scalerCrop(metadata));
 	    }
 	}
     };
 
     Libcam2OpenCV camera;
     MyCallback myCallback;
+
+    // 原始帧录制（FATIGUE_RECORD=文件）/ 回放（FATIGUE_REPLAY=文件）
+    Libcam2OpenCVRecorder recorder;
+    Libcam2OpenCVReplay replay;
+    bool replaying = false;
+
+    // 共享内存帧总线：发布摄像头帧（FATIGUE_BUS_PUBLISH=名称）
+    // 或从另一个采集进程读取帧（FATIGUE_BUS_ATTACH=名称）
+    FrameBusPublisher busPublisher;
+    FrameBusReader busReader;
+    std::thread busThread;
+    std::atomic<bool> busRunning{false};
+
+    // 检测线程忙时丢弃新帧，保证检测器按顺序处理帧（光流跟踪依赖相邻帧）
+    std::atomic<bool> detecting{false};
+
+    // 上一个送检帧的 ScalerCrop，变化时光流坐标失效
+    cv::Rect lastCrop;
 };
 
 #endif // WINDOW_H